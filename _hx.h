@@ -57,6 +57,9 @@
 #endif
 
 #include "hx.h"
+#ifdef HX_KIT
+#   include HX_KIT
+#endif
 typedef uint8_t BYTE;
 typedef uint16_t COUNT;
 typedef uint32_t PAGENO;
@@ -93,7 +96,9 @@ typedef int (*cmpfn_t) (const void *, const void *);
 #   error "Need a non-GCC way to specify attributes"
 #endif
 
-enum { HXPGRATE = 4 };
+// Every (hp->pgrate)th page is an overflow (or map) page; the rest
+//  are heads. The ratio is a power of two, fixed by hxcreate.
+enum { HXPGRATE = 4, HXPGRATE_MAX = 16 };
 
 typedef struct {
 
@@ -107,12 +112,20 @@ typedef struct {
 // Special case page layout: ROOT page [0].
 typedef struct {
 
-    COUNT   pgsize;             // size of each page
-    COUNT   version;            // #(data pages) per ovfl page
+    COUNT   pgsize;             // size of each page; 0 for 64K
+    COUNT   version;            // HXVERSION; the page ratio is in (flags)
     COUNT   uleng;              // BYTEs-used of data[]
-    COUNT   unused;
+    COUNT   flags;              // ROOT_* bits; zero before version 2.1
 } PACKED HXROOT;
 
+// ROOT_PGRATE: the page ratio, as HX_PGRATE codes it; 0 for HXPGRATE.
+// ROOT_SHRINK: the hxautoshrink floor percent (bits 3..8);
+// ROOT_GROW: the hxautogrow fill percent (bits 9..15). Each is 0
+//  if not set.
+enum { ROOT_HASH64 = 1, ROOT_PGRATE = 0x0006,
+    ROOT_SHRINK = 0x01F8, ROOT_GROW = 0xFE00
+};
+
 // In file, record prefix is (hash,leng) in LSB-first form:
 
 typedef struct {
@@ -122,13 +135,41 @@ typedef struct {
 
 #define MINRECSIZE      (sizeof(HXREC) + 1)
 
+// A blob record is too big for a page. In its chain, a stub holds
+//  the first BLOB_KEEP BYTEs of the record (which must hold its key),
+//  then a BLOBREF, then any HASH_TAIL; the stub's (leng) has REC_BLOB
+//  set. The rest of the record fills blob pages: overflow pages with
+//  (recs) 0, linked by (next), each filled to BLOB_DATA but the last.
+//  Only files of version 2.3 and up have blobs; (leng) in earlier
+//  files never reaches REC_BLOB.
+enum { REC_BLOB = 0x8000 };
+
+typedef struct {
+    PAGENO  first;              // first blob page
+    uint32_t leng;              // length of the whole record
+} PACKED BLOBREF;
+
 #define RECHASH(rp) (HXHASH)(LDUL(rp))
 //static inline HXHASH   RECHASH(void const *rp) { return LDUL(rp); }
 
+// In a ROOT_HASH64 file, a record's (leng) includes a HASH_TAIL
+//  suffix after the user data: the high 32 bits of its 64-bit hash.
+//  HXREC.hash holds the low 32 bits. The low bits place a record
+//  in hind[]; the high bits choose its head page.
+//  Internally, the hash of a record in a 32-bit file is (hash:hash),
+//  so that both halves are the same 32 bits.
+
 static inline unsigned
 RECLENG(void const *rp)
 {
-    return LDUS(sizeof(PAGENO) + (char const *)rp);
+    return LDUS(sizeof(PAGENO) + (char const *)rp) & ~REC_BLOB;
+}
+
+// IS_BLOB: REC_BLOB if the record is a blob stub, else 0.
+static inline unsigned
+IS_BLOB(void const *rp)
+{
+    return LDUS(sizeof(PAGENO) + (char const *)rp) & REC_BLOB;
 }
 
 static inline unsigned
@@ -163,17 +204,14 @@ typedef struct {
     HXPAGE *page;
 #   define   data    page->data
 
-    // Info required for increment _hxindexify:
+    // Info required for incremental hind[] changes:
 
-    int     delpos;             // offset of record deleted or replaced by hxput.
-    int     delta;              // change in length deleted or replaced by hxput.
-
-    // behind: hind[] entries that were overwritten by replace or append.
-    //  behind is __m128i-aligned and -sized, so that SSE2 ops
-    //  can be used to adjust it for (delpos,delta).
-    // When nbehind reaches 16, _hxindexify does a full reindex.
+    // behind: hind[] entries displaced by a record add/delete/resize,
+    //  pending reinsertion. behind is __m128i-aligned and -sized,
+    //  so that SSE2 ops can adjust its offsets with hind[]'s.
+    // If more than 64 are displaced, _hxsave does a full reindex.
     int     nbehind;
-    COUNT   behind[16] __attribute__ ((aligned(16)));
+    COUNT   behind[64] __attribute__ ((aligned(16)));
 
 } HXBUF;
 
@@ -181,7 +219,8 @@ enum { CLEAN = 0, DIRTY_DATA = 1, DIRTY_LINK = 2, DIRTY_INDEX = 4 };
 
 #define SHRUNK(bp)  ((bp)->used < (bp)->orig)
 #define SCRUB(bp)   ((bp)->flag  = CLEAN)
-#define STAIN(bp)   ((bp)->flag |= DIRTY_DATA)
+#define STAIN(bp)   ((bp)->flag |= DIRTY_DATA | DIRTY_INDEX)
+#define SPOT(bp)    ((bp)->flag |= DIRTY_DATA)  // hind[] kept current
 #define BLINK(bp)   ((bp)->flag |= DIRTY_LINK)
 #define DIRTY(bp)   ((bp)->flag != CLEAN)
 #define LINK(bp,pg) ((bp)->next = pg, BLINK(bp))
@@ -201,14 +240,18 @@ struct hxfile {
 
     HXMODE  mode;
     int     fileno;             // file descriptor
-    COUNT   pgsize;             // page size
-    COUNT   version;            // data-to-overflow ratio
+    unsigned pgsize;            // page size
+    COUNT   version;
     COUNT   uleng;              // Length of udata, in BYTEs
+    COUNT   flags;              // ROOT_* bits
+    COUNT   pgrate;             // pages per overflow page
+    COUNT   pgshift;            // log2(pgrate)
     char   *udata;              // User-defined data
 
     void   *dlfile;             // dlloaded record type methods
     HX_DIFF_FN diff;
     HX_HASH_FN hash;
+    HX_HASH64_FN hash64;
     HX_LOAD_FN load;
     HX_SAVE_FN save;
     HX_TEST_FN test;
@@ -224,7 +267,7 @@ struct hxfile {
 
     // _hxlock,_hxunlock:
     short   locked;             // flags for wide locks
-#   define  MAXLOCKS (HX_MAX_CHAIN + HXPGRATE*2 + 1)
+#   define  MAXLOCKS (HX_MAX_CHAIN + HXPGRATE_MAX*2 + 1)
     PAGENO  lockv[MAXLOCKS + 1];
 
     // _hxlockset:
@@ -240,6 +283,17 @@ struct hxfile {
     COUNT   recsize;            // of last rec returned
     // IS_MAP:
     PAGENO  map1;               // pgno of first map > 0 (perhaps not yet allocated)
+
+    // _hxfindfree: no ovfl page below (freehint) is free, as far as
+    //  this process knows. (freescan) is npages when it was last 0.
+    PAGENO  freehint;
+    PAGENO  freescan;
+    // hxdefrag: the next head to visit.
+    PAGENO  fraghint;
+    // hxautogrow/hxautoshrink: moving average of the bytes in
+    //  chains hxput walks, and samples to skip after a failed trim.
+    double  chainload;
+    int     shrinkwait;
 };
 
 // max bufs required by any one op
@@ -257,7 +311,7 @@ typedef struct {
     PAGENO  npages;             // curr. # of pages in file
     PAGENO  dpages;             // _hxd2f(npages)
     PAGENO  mask;               // (min power of 2 >= dpages) - 1
-    HXHASH  hash;               // key hash of target record
+    HXHASH64 hash;              // key hash of target record
     PAGENO  head;               // chain head page for key hash
     short   mode;               // lock mode for this op
     short   mylock;             // 1 if this call set a lock
@@ -267,6 +321,12 @@ typedef struct {
     // hxput:
     PAGENO  freed;              // Pending freed page
 
+    // hxdelv:
+    void   *delv;               // sortable vector of {recp,hash,head}
+    PAGENO *freev;              // emptied ovfl pages, freed at the end
+    BLOBREF *blobv;             // blobs of deleted stubs, freed likewise
+    int     nblobs;
+
     // hxref:
     PAGENO *vnext;              // (next) field of each page
     PAGENO *vprev;              // results of findHeads/findRefs
@@ -277,14 +337,23 @@ typedef struct {
 
     // hxfix:
     PAGENO *visit;              // xor'd head(s) of ovfl pages
+    COUNT  *vblob;              // BLOB_PAGE|BLOB_CLAIMED, per ovfl page
+
+    // hxscan, hxscan_part:
+    BYTE   *seen;               // bitmap of pages already scanned
+    char   *scanbuf;            // pages read by one _hxread
 
     // hxbuild:
     int     memsize;            // XXX size_t
     char   *membase;
     char   *mem;                // membase aligned(DISK_PGSIZE)
     void   *recv;               // sortable vector of {HXREC*,PAGENO}
-    int     mapsize;
+    off_t   mapsize;
     char   *tmpmap;             // mmap-ed partition file
+    char   *inpmap;             // mmap-ed input file (if a regular file)
+    off_t   inplen, inppos;
+    char   *ovfv;               // HXRECs for hxput after bulk load;
+    int     ovflen, ovfmax;     //  beyond ovfmax, they go to fp[1].
     int     nfps;
     FILE   *fp[3];
 
@@ -297,20 +366,29 @@ typedef struct {
 //-----|-------|-------|-------|-------|-------|-------|-------|
 // A fn with (HXLOCAL const*) cannot error-out.
 void    _hxaddlock(HXFILE *, PAGENO) regargs;
+void    _hxaddrec(HXLOCAL const *, HXBUF *, HXHASH64, char const *, COUNT) regargs;
 void    _hxalloc(HXLOCAL *, PAGENO, int bitval) regargs;
 void    _hxappend(HXBUF *, char const *, COUNT) regargs;
+void    _hxautoshape(HXLOCAL *, double chainbytes) regargs;
+int     _hxautotrim(HXLOCAL *) regargs;
+int     _hxbinbind(HXFILE *, char const *type) regargs;
+void    _hxblobfree(HXLOCAL *, HXBUF *, BLOBREF) regargs;
+int     _hxblobget(HXLOCAL *, char const *recp, char *buf, int size) regargs;
+char   *_hxblobstub(HXLOCAL *, char const *recp, int leng) regargs;
 char   *_hxblockstr(HXFILE *, char *) regargs;
 HXRET   _hxcheckbuf(HXLOCAL const *, HXBUF const *) regargs;
 void    _hxdebug(char const *func, int line, char const *fmt, ...) regargs;
+void    _hxdelrec(HXLOCAL const *, HXBUF *, COUNT pos) regargs;
 void    _hxenter(HXLOCAL *, HXFILE *, char const *, int nbufs) regargs;
-int     _hxfind(HXLOCAL *, HXBUF const *, HXHASH, char const *, int *hindp) regargs;
+int     _hxfind(HXLOCAL *, HXBUF const *, HXHASH64, char const *, int *hindp) regargs;
 void    _hxflushfreed(HXLOCAL *, HXBUF *) regargs;
 int     _hxgetfreed(HXLOCAL *, HXBUF *) regargs;
 void    _hxputfreed(HXLOCAL *, HXBUF *) regargs;
 void    _hxfresh(HXLOCAL const *, HXBUF *, PAGENO) regargs;
 int     _hxfindfree(HXLOCAL *, HXBUF *) regargs;
+int     _hxfindnear(HXLOCAL *, HXBUF *, PAGENO from, PAGENO below) regargs;
 void    _hxgrow(HXLOCAL *, HXBUF *, COUNT, PAGENO *) regargs;
-PAGENO  _hxhead(HXLOCAL const *locp, HXHASH) regargs;
+PAGENO  _hxhead(HXLOCAL const *locp, HXHASH64) regargs;
 char   *_hxheads(HXLOCAL *, HXBUF const *, char *outstr) regargs;
 COUNT  *_hxindex(HXFILE const *, HXBUF const *, HXHASH) regargs;
 int     _hxindexed(HXLOCAL *, HXBUF const *) regargs;
@@ -332,13 +410,16 @@ void    _hxprloc(HXLOCAL const *) regargs;
 void    _hxprlox(HXFILE *) regargs;
 void    _hxread(HXLOCAL *, off_t, void *, int) regargs;
 void    _hxremap(HXLOCAL *) regargs;
-void    _hxremove(HXBUF *, COUNT pos, COUNT size) regargs;
 void    _hxresize(HXLOCAL *, PAGENO) regargs;
 void    _hxsave(HXLOCAL *, HXBUF *) regargs;
+void    _hxsetflags(HXLOCAL *, COUNT) regargs;
+void    _hxsetrec(HXLOCAL const *, HXBUF *, COUNT pos, char const *,
+                  COUNT) regargs;
 int     _hxshare(HXLOCAL *, HXBUF *, COUNT need) regargs;
 int     _hxshift(HXLOCAL const *, PAGENO lo, PAGENO hi,
                  HXBUF * srcp, HXBUF * lowerp, HXBUF * upperp) regargs;
 void    _hxsize(HXLOCAL *) regargs;
+void    _hxsplitall(HXLOCAL *, PAGENO from) regargs;
 void    _hxsplits(HXFILE *, PAGENO *, PAGENO);
 int     _hxtemp(HXLOCAL *, char *vbuf, int vbufsize) regargs;
 void    _hxunlock(HXLOCAL *, PAGENO start, PAGENO npages) regargs;
@@ -351,7 +432,7 @@ PAGENO  _hxgetRef(HXLOCAL const *, PAGENO head, PAGENO tail) regargs;
 void    _hxsetRef(HXLOCAL *, PAGENO pg, PAGENO next) regargs;
 
 // VREF is used by (hxfix, hxshape) as an lvalue.
-#define VREF(locp,pg) ((locp)->vrefs[(pg)/HXPGRATE])
+#define VREF(locp,pg) ((locp)->vrefs[(pg) >> (locp)->file->pgshift])
 
 #define ENTER(locp, hp, rec, nbufs) \
         memset(locp, 0, sizeof(HXLOCAL)); \
@@ -372,23 +453,55 @@ static inline char *_hxcurrec(HXFILE const *hp)
     return hp->buffer.data + hp->currpos;
 }
 
+// _hxd2f, _hxf2d: map a head (data page) number to its page number
+//  in the file, and back. pg * rate / (rate - 1), without overflow.
 static inline PAGENO
-_hxd2f(PAGENO pg)
+_hxd2f(HXFILE const *hp, PAGENO pg)
 {
-    return pg * HXPGRATE / (HXPGRATE - 1) + 1;
+    return pg + pg / (hp->pgrate - 1) + 1;
 }
 
 static inline PAGENO
-_hxf2d(PAGENO pg)
+_hxf2d(HXFILE const *hp, PAGENO pg)
+{
+    return (pg - 1) - ((pg - 1) >> hp->pgshift);
+}
+
+// Version 2 pages: hind[] size depends only on (recs). It is the
+//  smallest (2**k or 3 * 2**k) with more than (recs + recs/8) slots,
+//  so few appends resize hind[] at all.
+//  Pages of FINGER_PGSIZE and up have fingerprints, except with
+//  one record, so hxmaxrec is the same as for version 1.
+// Version 1 pages: hind[] fills whatever (used) leaves free.
+// Used by _FITS below.
+enum { FINGER_PGSIZE = 1024 };
+
+static inline int
+FIXED_HIND(HXFILE const *hp)
 {
-    return (pg - 1) - (pg - 1) / HXPGRATE;
+    return hp->version >= 0x0200;
 }
 
-// Used by _FITS below
 static inline int
-MIN_INDEX_BYTES(int nrecs)
+FIXED_HSIZE(int nrecs)
 {
-    return (nrecs + (nrecs + 7) / 8) * sizeof(COUNT);
+    int     need = nrecs + nrecs / 8 + 1;
+    int     pow2 = need > 2 ? 2 << (31 - __builtin_clz(need - 1)) : 2;
+
+    return pow2 / 4 * 3 >= need ? pow2 / 4 * 3 : pow2;
+}
+
+static inline int
+FIXED_SLOT(HXFILE const *hp, int nrecs)
+{
+    return sizeof(COUNT) + (nrecs > 1 && hp->pgsize >= FINGER_PGSIZE);
+}
+
+static inline int
+MIN_INDEX_BYTES(HXFILE const *hp, int nrecs)
+{
+    return FIXED_HIND(hp) ? FIXED_HSIZE(nrecs) * FIXED_SLOT(hp, nrecs)
+        : (nrecs + (nrecs + 7) / 8) * (int)sizeof(COUNT);
 }
 
 static inline void
@@ -412,14 +525,26 @@ DATASIZE(HXFILE const *hp)
 static inline int
 FILE_HELD(HXFILE const *hp)
 {
-    return hp->hold == HXPGRATE;
+    return hp->hold == HXPGRATE_MAX;
+}
+
+// FINGER: fingerprint of a record hash; 0 marks an empty slot.
+//  All records in a chain share their high (head) hash bits,
+//  and hind[] position is the low bits: multiply to mix both.
+static inline BYTE
+FINGER(HXHASH hash)
+{
+    BYTE    f = (hash * 2654435761U) >> 24;
+
+    return f ? f : 1;
 }
 
 //FITS and _FITS takes signed (int) used, because hxput tests shrinkage (dused<0)
 static inline unsigned
 _FITS(HXFILE const *hp, int sused, int srecs, int dused, int drecs)
 {
-    return (sused + dused) + MIN_INDEX_BYTES(srecs + drecs) <= (int)DATASIZE(hp);
+    return (sused + dused) + MIN_INDEX_BYTES(hp, srecs + drecs)
+        <= (int)DATASIZE(hp);
 }
 
 static inline unsigned
@@ -428,6 +553,115 @@ FITS(HXFILE const *hp, HXBUF const *bp, int dused, int drecs)
     return dused < 0 || _FITS(hp, bp->used, bp->recs, dused, drecs);
 }
 
+// KIT_DIFF, KIT_HASH, KIT_HASH64: the record type's methods.
+//  With -DHX_KIT='"kit.h"', libhx serves one record type: kit.h
+//  defines static inline hxkit_diff and hxkit_hash (and
+//  hxkit_hash64, with HXKIT_HASH64 defined), so these calls are
+//  direct, and hxopen binds the kit over hxbind/hxlib methods.
+//  hxopen fails with EBADF for a file whose type is not the
+//  kit's HXKIT_TYPE. Without HXKIT_HASH64, KIT_HASH64 uses the
+//  hash64 method of the type library, if it has one.
+//  hxkit_.h is the kit for the default type.
+static inline int
+KIT_DIFF(HXFILE const *hp, char const *reca, char const *recb)
+{
+#ifdef HX_KIT
+    return hxkit_diff(reca, recb, hp->udata, hp->uleng);
+#else
+    return hp->diff(reca, recb, hp->udata, hp->uleng);
+#endif
+}
+
+static inline HXHASH
+KIT_HASH(HXFILE const *hp, char const *recp)
+{
+#ifdef HX_KIT
+    return hxkit_hash(recp, hp->udata, hp->uleng);
+#else
+    return hp->hash(recp, hp->udata, hp->uleng);
+#endif
+}
+
+static inline HXHASH64
+KIT_HASH64(HXFILE const *hp, char const *recp)
+{
+#if defined(HX_KIT) && defined(HXKIT_HASH64)
+    return hxkit_hash64(recp, hp->udata, hp->uleng);
+#else
+    HXHASH  h;
+
+    if (hp->hash64)
+        return hp->hash64(recp, hp->udata, hp->uleng);
+    h = KIT_HASH(hp, recp);
+    return (HXHASH64) h << 32 | h;
+#endif
+}
+
+// HASH_TAIL: BYTEs of hash after the user data of each record.
+static inline int
+HASH_TAIL(HXFILE const *hp)
+{
+    return hp->flags & ROOT_HASH64 ? sizeof(HXHASH) : 0;
+}
+
+// GROW_FILL: the hxautogrow fill percent; 0 if none.
+static inline int
+GROW_FILL(HXFILE const *hp)
+{
+    return (hp->flags & ROOT_GROW) >> 9;
+}
+
+// SHRINK_FLOOR: the hxautoshrink floor percent; 0 if none.
+static inline int
+SHRINK_FLOOR(HXFILE const *hp)
+{
+    return (hp->flags & ROOT_SHRINK) >> 3;
+}
+
+// PGRATE_SHIFT: log2 of the page ratio in root (flags).
+static inline int
+PGRATE_SHIFT(COUNT flags)
+{
+    return "\2\1\3\4"[(flags & ROOT_PGRATE) >> 1];
+}
+
+// _hxsample: fold the bytes of one whole chain into hp->chainload.
+static inline void
+_hxsample(HXFILE * hp, double chainbytes)
+{
+    hp->chainload += hp->chainload
+        ? (chainbytes - hp->chainload) / 64 : chainbytes;
+}
+
+// _hxhash: hash of a record as this file uses it; see HASH_TAIL.
+static inline HXHASH64
+_hxhash(HXFILE const *hp, char const *recp)
+{
+    HXHASH  h;
+
+    if (HASH_TAIL(hp))
+        return KIT_HASH64(hp, recp);
+
+    h = KIT_HASH(hp, recp);
+    return (HXHASH64) h << 32 | h;
+}
+
+// HAS_FINGERS: files of version 1.1 and up keep a one-BYTE
+//  fingerprint per hind[] slot. In version 1.1, that is in pages
+//  where (used,recs) leave room for it; a fuller page has a plain
+//  hind[]. In version 2, see FIXED_SLOT.
+static inline int
+HAS_FINGERS(HXFILE const *hp, HXBUF const *bp)
+{
+    if (FIXED_HIND(hp))
+        return FIXED_SLOT(hp, bp->recs) > (int)sizeof(COUNT);
+
+    int     nslots = (DATASIZE(hp) - bp->used) / (sizeof(COUNT) + 1);
+
+    return (hp->version & 0x00FF) >= 0x01
+        && nslots >= bp->recs + (bp->recs + 7) / 8;
+}
+
 static inline int
 HEAD_HELD(HXLOCAL const *locp)
 {
@@ -446,24 +680,64 @@ HIND_BASE_C(HXFILE const *hp, HXBUF const *bufp)
     return (COUNT *) (bufp->data + DATASIZE(hp)) - 1;
 }
 
+// HIND_FING: fingerprints are stored just below hind[hsize-1];
+//  slot i's is at [-i], like hind[-i], so a probe sequence
+//  (i, i-1, ...) reads ascending addresses.
+// HIND_DIST: probe distance from slot (home) down to slot (i).
+static inline int
+HIND_DIST(int home, int i, int hsize)
+{
+    return home >= i ? home - i : home - i + hsize;
+}
+
+static inline BYTE const *
+HIND_FING(HXFILE const *hp, HXBUF const *bp, COUNT const *hind, int hsize)
+{
+    return HAS_FINGERS(hp, bp) ? (BYTE const *)(hind - hsize + 1) - 1 : NULL;
+}
+
+// HIND_FING_W: HIND_FING for code that updates hind[].
+static inline BYTE *
+HIND_FING_W(HXFILE const *hp, HXBUF const *bp, COUNT * hind, int hsize)
+{
+    return HAS_FINGERS(hp, bp) ? (BYTE *) (hind - hsize + 1) - 1 : NULL;
+}
+
+// HIND_HOME: first slot probed for (hash). Slots past hsize fold
+//  down by half the mask, as linear hashing does with pages.
+static inline int
+HIND_HOME(HXHASH hash, unsigned mask, int hsize)
+{
+    int     ret = hash & mask;
+
+    return ret < hsize ? ret : ret & (int)(mask >> 1);
+}
+
 static inline COUNT
 HIND_POS(HXBUF const *bufp, HXHASH hash)
 {
-    COUNT   ret = hash & bufp->hmask;
+    return HIND_HOME(hash, bufp->hmask, bufp->hsize);
+}
 
-    return ret < bufp->hsize ? ret : ret & (bufp->hmask >> 1);
+// HIND_SLOT: BYTEs per in-page index slot. Used by HIND_SIZE.
+static inline int
+HIND_SLOT(HXFILE const *hp, HXBUF const *bp)
+{
+    return sizeof(COUNT) + HAS_FINGERS(hp, bp);
 }
 
 static inline int
 HIND_SIZE(HXFILE const *hp, HXBUF const *bp)
 {
-    return (DATASIZE(hp) - bp->used) / sizeof(COUNT);
+    return FIXED_HIND(hp) ? FIXED_HSIZE(bp->recs)
+        : (int)(DATASIZE(hp) - bp->used) / HIND_SLOT(hp, bp);
 }
 
 static inline void
 HOLD_FILE(HXFILE * hp)
 {
-    hp->hold = HXPGRATE, hp->locked = LOCKED_FILE;
+    // No ratio makes page HXPGRATE_MAX a head.
+    hp->hold = HXPGRATE_MAX, hp->locked = LOCKED_FILE;
 }
 
 static inline void
@@ -479,17 +753,17 @@ IMIN(int a, int b)
 }
 
 static inline int
-IS_HEAD(PAGENO pg)
+IS_HEAD(HXFILE const *hp, PAGENO pg)
 {
-    return pg % HXPGRATE;
+    return pg & (hp->pgrate - 1);
 }
 
 static inline int
 IS_MAP(HXFILE const *hp, PAGENO pgno)
 {
     return pgno == 0 || pgno == hp->map1
-        || (pgno > hp->map1 && 0 == (pgno + 8 * HXPGRATE * hp->uleng)
-            % (8 * HXPGRATE * DATASIZE(hp)));
+        || (pgno > hp->map1 && 0 == (pgno + 8 * hp->pgrate * hp->uleng)
+            % (8 * hp->pgrate * DATASIZE(hp)));
 }
 
 static inline int
@@ -533,14 +807,28 @@ MAX_RECS(HXFILE const *hp)
 static inline PAGENO
 NEXT_MAP(HXFILE const *hp, PAGENO mappg)
 {
-    return mappg + 8 * HXPGRATE * (DATASIZE(hp) - (mappg ? 0 : -hp->uleng));
+    return mappg ? mappg + 8 * hp->pgrate * DATASIZE(hp) : hp->map1;
 }
 
+// OK_VERSION: hx reads and updates files of its own major version
+//  and no later minor version, and version 1 (1.0, 1.1) files,
+//  which hxfix upgrades.
 static inline int
 OK_VERSION(COUNT version)
 {
     return !(0xFF00 & (version ^ hxversion))
-        && (0x00FF & version) <= (0x00FF & hxversion);
+        ? (0x00FF & version) <= (0x00FF & hxversion)
+        : version == 0x0100 || version == 0x0101;
+}
+
+static inline HXHASH64
+RECHASH64(HXFILE const *hp, void const *rp)
+{
+    HXHASH  lo = RECHASH(rp);
+    HXHASH  hi = HASH_TAIL(hp) ? LDUL((char const *)rp + RECSIZE(rp)
+                                      - sizeof(HXHASH)) : lo;
+
+    return (HXHASH64) hi << 32 | lo;
 }
 
 static inline HXHASH
@@ -549,6 +837,18 @@ REV_HASH(HXHASH x)
     return bswap_32(x);
 }
 
+// RH_HIND: hind[] of version 2.2 pages is in Robin Hood order:
+//  along a probe run, no entry is further from its home slot than
+//  the entry before it, plus one. A lookup can stop at the first
+//  entry nearer its home than the key would be. Older pages are
+//  only valid for probing up to an empty slot. New entries are
+//  always placed in Robin Hood order, which suits both.
+static inline int
+RH_HIND(HXFILE const *hp)
+{
+    return hp->version >= 0x0202;
+}
+
 static inline unsigned
 ROOT_SIZE(HXFILE const *hp)
 {
@@ -567,27 +867,82 @@ SCANNING(HXFILE const *hp)
 static inline PAGENO
 SPLIT_HI(HXLOCAL *locp, PAGENO pg)
 {
-    pg = _hxf2d(pg);
+    pg = _hxf2d(locp->file, pg);
     PAGENO delta = locp->mask + 1;
     if (pg <= locp->mask)
         delta >>= 1;
-    return _hxd2f(pg + delta);
+    return _hxd2f(locp->file, pg + delta);
 }
 
 static inline PAGENO
-SPLIT_LO(PAGENO pg)
+SPLIT_LO(HXFILE const *hp, PAGENO pg)
 {
-    pg = _hxf2d(pg);
-    return _hxd2f(pg - (MASK(pg) + 1)/2);
+    pg = _hxf2d(hp, pg);
+    return _hxd2f(hp, pg - (MASK(pg + 1) + 1)/2);
 }
 
 static inline PAGENO
 SPLIT_PAGE(HXLOCAL const *locp)
 {
-    return _hxd2f(locp->dpages - (locp->mask + 1)/2);
+    return _hxd2f(locp->file,
+                  locp->dpages - (MASK(locp->dpages + 1) + 1)/2);
 }
 
 #define TWIXT(x,a,z) ((unsigned)((x)-(a)) <= (unsigned)(z)-(a))
+
+// USERLENG: length of the user data in a record.
+static inline unsigned
+USERLENG(HXFILE const *hp, void const *rp)
+{
+    return RECLENG(rp) - HASH_TAIL(hp);
+}
+
+// HAS_BLOBS: files of version 2.3 and up take records longer than
+//  hxmaxrec, as blobs.
+static inline int
+HAS_BLOBS(HXFILE const *hp)
+{
+    return hp->version >= 0x0203;
+}
+
+// BLOB_DATA: BYTEs of a blob in each (but the last) blob page.
+static inline unsigned
+BLOB_DATA(HXFILE const *hp)
+{
+    return DATASIZE(hp) - MIN_INDEX_BYTES(hp, 0);
+}
+
+// BLOB_KEEP: BYTEs of a blob kept in its stub.
+static inline unsigned
+BLOB_KEEP(HXFILE const *hp)
+{
+    return hxmaxrec(hp) / 8;
+}
+
+static inline BLOBREF
+BLOB_REF(HXFILE const *hp, void const *rp)
+{
+    char const *cp = RECDATA(rp) + USERLENG(hp, rp) - sizeof(BLOBREF);
+
+    return (BLOBREF) {
+    LDUL(cp), LDUL(cp + sizeof(PAGENO))};
+}
+
+// IS_BLOBPG: the page holds part of a blob.
+static inline int
+IS_BLOBPG(HXFILE const *hp, HXBUF const *bp)
+{
+    return bp->used && !bp->recs && !IS_HEAD(hp, bp->pgno)
+        && !IS_MAP(hp, bp->pgno);
+}
+
+// WHOLELENG: user length of the whole record; for a blob, the
+//  length of the record that its stub stands for.
+static inline unsigned
+WHOLELENG(HXFILE const *hp, void const *rp)
+{
+    return IS_BLOB(rp) ? BLOB_REF(hp, rp).leng : USERLENG(hp, rp);
+}
 //--------------|---------------------------------------------
 // "hxcrash" makes the (n)th _hxsave call abort()
 // Used to create corrupt files to test HX_REPAIR.
@@ -622,6 +977,8 @@ extern int hxcrash;
 // bad_used_bit Opposite of "bad_free_bit".
 
 //---- ERRORS THAT MAKE A FILE UNREADABLE:
+// bad_blob A blob stub's pages are missing, are not blob pages,
+//              or are claimed by another stub.
 // bad_loop An overflow chain contains a loop.
 // bad_next (next) is not 0 and not an overflow pgno.
 // bad_rec_hash rec.hash in file does not match hx_hash(rec).
@@ -631,7 +988,7 @@ extern int hxcrash;
 //                  or vice versa.
 
 #define FATAL_LIST \
-    _E(bad_index)_C     _E(bad_loop)_C	    _E(bad_next)_C  \
+    _E(bad_blob)_C      _E(bad_index)_C     _E(bad_loop)_C  _E(bad_next)_C \
     _E(bad_rec_hash)_C  _E(bad_rec_size)_C  _E(bad_used)
 
 #define ERROR_LIST  \
@@ -45,7 +45,7 @@ main(void)
     setvbuf(stdout, 0, _IOLBF, 0);
     setvbuf(stderr, 0, _IOLBF, 0);
 
-    plan_tests(186);
+    plan_tests(198);
 
     // COVERAGE
     int     fd = creat("basic_t.hx", 0755);
@@ -117,7 +117,7 @@ main(void)
     hxclose(NULL);
 
     rc = hxcreate("basic_t.hx", 0666, 4096, "ch", 2);
-    ok(rc == HXOKAY, "create hxfile with version 0x100: %s", hxerror(rc));
+    ok(rc == HXOKAY, "create hxfile with version 0x203: %s", hxerror(rc));
     ok(hp =
        hxopen("basic_t.hx", 0),
        "open hxfile with version matching hxversion: %s", strerror(errno));
@@ -146,6 +146,32 @@ main(void)
        strerror(errno));
     hxclose(hp);
 
+    // A 64K pgsize is stored as 0 in the root.
+    rc = hxcreate("basic_t.hx", 0666, 65536, "ch", 2);
+    ok(rc == HXOKAY, "create hxfile with 64K pagesize: %s", hxerror(rc));
+    hp = hxopen("basic_t.hx", HX_UPDATE);
+    ok(hp && hxmaxrec(hp) == 32767, "open hxfile with 64K pagesize: %s",
+       strerror(errno));
+    if (hp) {
+        static char big[65536];
+
+        memset(big, 'b', hxmaxrec(hp));
+        rc = hxput(hp, big, hxmaxrec(hp));
+        big[2] = '?';
+        ok(rc == 0 && hxget(hp, big, sizeof big) == hxmaxrec(hp)
+           && big[2] == 'b', "64K page holds a %d byte record", hxmaxrec(hp));
+        memset(big, 'c', sizeof big);
+        rc = hxput(hp, big, sizeof big);
+        big[sizeof big - 1] = '?';
+        ok(rc == 0 && hxget(hp, big, sizeof big) == sizeof big
+           && big[sizeof big - 1] == 'c', "64K page file holds a 64K blob");
+        hxclose(hp);
+    }
+
+    rc = hxcreate("basic_t.hx", 0666, 131072, "ch", 2);
+    ok(rc == HXERR_BAD_REQUEST, "hxcreate rejects 128K pagesize: %s",
+       hxerror(rc));
+
     // (COVERAGE)
     // Create a hxfile with a single map byte in the root page.
     // The next map will be page 32 (8bits/byte * HXPGRATE).
@@ -365,12 +391,13 @@ main(void)
         ok(buf[2] == '#', "hxget fetches updated record");
 
         rc = hxput(hp, buf, hxmaxrec(hp) + 1);
-        ok(rc == HXERR_BAD_REQUEST,
-           "hxput rejected record too large for file: %s", hxerror(rc));
+        ok(rc == hxmaxrec(hp),
+           "hxput stored record too large for a page as a blob: %s",
+           hxerror(rc));
 
         rc = hxdel(hp, buf);
-        ok(rc == hxmaxrec(hp), "first hxdel reported record deleted: %s (%d)",
-           hxerror(rc), rc);
+        ok(rc == hxmaxrec(hp) + 1,
+           "first hxdel reported blob deleted: %s (%d)", hxerror(rc), rc);
 
         buf[1] = ':';
         rc = hxdel(hp, buf);
@@ -432,5 +459,52 @@ main(void)
 
     hxclose(hp);
 
+    // Built-in types need no library (LD_LIBRARY_PATH is unset).
+    int     i, found;
+    char    key[20];
+
+    rc = hxcreate("basic_t.hx", 0644, 1024, "bin16", 5);
+    hp = hxopen("basic_t.hx", HX_UPDATE);
+    ok(hp && hxlib(hp, "bin16", NULL) == 7, "bin16 type is built in");
+
+    for (i = found = 0; i < 2000; ++i) {
+        memset(key, 0, sizeof key);
+        memcpy(key + i % 13, &i, sizeof i);
+        memcpy(key + 16, &i, sizeof i);
+        hxput(hp, key, 20);
+    }
+    for (i = 0; i < 2000; ++i) {
+        memset(key, 0, sizeof key);
+        memcpy(key + i % 13, &i, sizeof i);
+        found += hxget(hp, key, sizeof key) == 20
+                 && !memcmp(key + 16, &i, sizeof i);
+    }
+    ok(found == 2000, "bin16: found %d/2000 keys with embedded NULs", found);
+
+    rc = hx_save(hp, key, 20, buf2, sizeof buf2);
+    len = hx_load(hp, buf, sizeof buf, buf2);
+    ok(rc == 42 && len == 20 && !memcmp(buf, key, 20),
+       "bin16: save/load round trip: %s", buf2);
+    ok(hx_load(hp, buf, sizeof buf, "0102") <= 0, "bin16: short key rejected");
+    hxclose(hp);
+
+    hp = hxopen("basic_t.hx", HX_READ);
+    rc = hxfix(hp, 0, 0, 0, 0);
+    hxclose(hp);
+    ok(rc == (HXRET) HX_UPDATE, "bin16 file checks okay");
+
+    rc = hxcreate("basic_t.hx", 0644 | HX_HASH64, 1024, "binv", 4);
+    hp = hxopen("basic_t.hx", HX_UPDATE);
+    hxput(hp, "\003abcX", 5);
+    hxput(hp, "\002abY", 4);
+    hxput(hp, "\003abcZ", 5);
+    strcpy(buf, "\003abc");
+    len = hxget(hp, buf, sizeof buf);
+    ok(len == 5 && buf[4] == 'Z', "binv: length-prefixed key replaced");
+    strcpy(buf, "\002ab");
+    len = hxget(hp, buf, sizeof buf);
+    ok(len == 4 && buf[3] == 'Y', "binv: shorter key is distinct");
+    hxclose(hp);
+
     return exit_status();
 }
@@ -0,0 +1,288 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// blob_t: records longer than hxmaxrec, stored in blob pages.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap.h"
+
+#include "hx.h"
+
+#define NBLOBS  40
+#define NSMALL  400
+
+// mkrec: "bNNNN\0" plus (leng - 7) bytes of value, plus "\0".
+static int
+mkrec(char *buf, int i, int leng)
+{
+    int     j;
+
+    sprintf(buf, "b%04d", i);
+    for (j = 6; j < leng - 1; ++j)
+        buf[j] = 'a' + (i + j) % 26;
+    buf[leng - 1] = 0;
+    return leng;
+}
+
+static int
+bloblen(HXFILE * hp, int i)
+{
+    return hxmaxrec(hp) + 1 + i * 997;
+}
+
+static int
+blobpages(HXFILE * hp)
+{
+    HXSTAT  st;
+
+    return hxstat(hp, &st) ? -1 : (int)st.blob_pages;
+}
+
+static int
+is_blob(char const *rec, int leng, void *ctx)
+{
+    int     hit = leng > 100 && atoi(rec + 1) % 2;
+
+    *(int *)ctx += hit;
+    return hit;
+}
+
+// samediff, samehash, anyrec: a record type that puts every
+//  record in one chain.
+static int
+samediff(char const *a, char const *b, char const *udata, int uleng)
+{
+    (void)udata, (void)uleng;
+    return strcmp(a, b);
+}
+
+static HXHASH
+samehash(char const *rec, char const *udata, int uleng)
+{
+    (void)rec, (void)udata, (void)uleng;
+    return 0;
+}
+
+static int
+anyrec(char const *rec, int leng, char const *udata, int uleng)
+{
+    (void)rec, (void)leng, (void)udata, (void)uleng;
+    return 1;
+}
+
+// Count records whose tail is intact: a blob is passed whole.
+static int
+is_whole(char const *rec, int leng, void *ctx)
+{
+    int     i = atoi(rec + 1);
+
+    *(int *)ctx += !rec[leng - 1] && rec[leng - 2] == 'a' + (i + leng - 2) % 26;
+    return 0;
+}
+
+int
+main(void)
+{
+    HXRET   rc;
+    HXFILE *hp;
+    HXMODE  mode;
+    int     i, leng, bad, nrecs, maxlen = 0;
+    char   *rec, *buf;
+    char const *keyv[NBLOBS];
+    char    keys[NBLOBS][8];
+
+    plan_tests(2 * 20 + 3);
+    setvbuf(stdout, 0, _IOLBF, 0);
+
+    for (mode = 0; mode <= HX_MMAP; mode += HX_MMAP) {
+        rc = hxcreate("blob_t.hx", 0644, 1024, NULL, 0);
+        ok(HXOKAY == rc, "created blob_t.hx: %s", hxerror(rc));
+
+        hp = hxopen("blob_t.hx", HX_UPDATE + mode);
+        ok(hp, "opened blob_t.hx with %s", hxmode(HX_UPDATE + mode));
+
+        maxlen = bloblen(hp, NBLOBS);
+        rec = malloc(maxlen);
+        buf = malloc(maxlen);
+
+        // Interleave blobs with small records, so that
+        //  blob pages and chain pages share the file.
+        for (i = 0; i < NBLOBS + NSMALL; ++i) {
+            leng = mkrec(rec, i, i < NBLOBS ? bloblen(hp, i) : 20);
+            if (0 > (rc = hxput(hp, rec, leng)))
+                break;
+        }
+        ok(i == NBLOBS + NSMALL, "inserted %d records: %s", i, hxerror(rc));
+        ok(blobpages(hp) > NBLOBS, "%d blob pages", blobpages(hp));
+
+        for (i = bad = 0; i < NBLOBS + NSMALL; ++i) {
+            leng = mkrec(rec, i, i < NBLOBS ? bloblen(hp, i) : 20);
+            sprintf(buf, "b%04d", i);
+            bad += hxget(hp, buf, maxlen) != leng || memcmp(buf, rec, leng);
+        }
+        ok(bad == 0, "hxget returned %d bad records", bad);
+
+        mkrec(rec, 3, bloblen(hp, 3));
+        strcpy(buf, "b0003");
+        rc = hxget(hp, buf, 100);
+        ok(rc == bloblen(hp, 3) && !memcmp(buf, rec, 100),
+           "hxget into a short buffer returns the whole length: %d", rc);
+
+        for (nrecs = bad = 0; (leng = hxnext(hp, buf, maxlen)) > 0; ++nrecs)
+            bad += leng != (atoi(buf + 1) < NBLOBS ? bloblen(hp, atoi(buf + 1)) : 20);
+        hxrel(hp);
+        ok(nrecs == NBLOBS + NSMALL && bad == 0,
+           "hxnext returned %d records, %d bad", nrecs, bad);
+
+        nrecs = 0;
+        rc = hxscan(hp, is_whole, &nrecs);
+        ok(rc == NBLOBS + NSMALL && nrecs == rc,
+           "hxscan passed %d whole records", nrecs);
+
+        // Replace a blob with a small record and back again.
+        leng = mkrec(rec, 5, 20);
+        rc = hxput(hp, rec, leng);
+        ok(rc == bloblen(hp, 5), "small replaces blob, returns %d", rc);
+        leng = mkrec(rec, 5, bloblen(hp, 7));
+        rc = hxput(hp, rec, leng);
+        strcpy(buf, "b0005");
+        ok(rc == 20 && hxget(hp, buf, maxlen) == leng && !memcmp(buf, rec, leng),
+           "blob replaces small, returns %d", rc);
+
+        // Blob pages are not overflow pages: hxshape_step has
+        //  no reason to grow a file of blobs by its whole budget.
+        rc = hxshape_step(hp, 0.0, 1000);
+        ok(rc >= 0 && rc < 1000, "hxshape_step moved %d pages", rc);
+
+        // hxreserve splits chains; blob pages stay where they are.
+        rc = hxreserve(hp, 100000, 20);
+        for (i = bad = 0; i < NBLOBS + NSMALL; ++i) {
+            leng = mkrec(rec, i, i == 5 ? bloblen(hp, 7)
+                         : i < NBLOBS ? bloblen(hp, i) : 20);
+            sprintf(buf, "b%04d", i);
+            bad += hxget(hp, buf, maxlen) != leng || memcmp(buf, rec, leng);
+        }
+        ok(rc > 0 && bad == 0 && hxfix(hp, 0, 0, 0, 0) == (HXRET) HX_UPDATE,
+           "hxreserve added %d pages, %d bad records", rc, bad);
+
+        rc = hxshape(hp, 0.0);
+        for (i = bad = 0; i < NBLOBS; ++i) {
+            sprintf(buf, "b%04d", i);
+            bad += hxget(hp, buf, maxlen) <= hxmaxrec(hp);
+        }
+        ok(rc >= 0 && bad == 0, "hxshape kept blobs: %d bad, %s", bad,
+           hxerror(rc));
+
+        rc = hxfix(hp, 0, 0, 0, 0);
+        ok(rc == (HXRET) HX_UPDATE, "hxfix accepts blob pages: %s",
+           hxmode(rc));
+
+        nrecs = 0;
+        rc = hxpurge(hp, is_blob, &nrecs);
+        ok(rc == NBLOBS / 2 && nrecs == rc,
+           "hxpurge saw whole blobs, deleted %d", rc);
+
+        for (i = 0; i < NBLOBS; i += 2)
+            sprintf(keys[i / 2], "b%04d", i), keyv[i / 2] = keys[i / 2];
+        rc = hxdelv(hp, keyv, NBLOBS / 2);
+        ok(rc == NBLOBS / 2, "hxdelv deleted %d blobs", rc);
+        ok(blobpages(hp) == 0, "no blob pages left: %d", blobpages(hp));
+
+        hxclose(hp);
+        hp = hxopen("blob_t.hx", HX_READ);
+        rc = hxfix(hp, 0, 0, 0, 0);
+        ok(rc == (HXRET) HX_UPDATE, "file not corrupted: %s", hxmode(rc));
+        hxclose(hp);
+
+        // Blobs freed by hxdel are reused by the next blob.
+        hp = hxopen("blob_t.hx", HX_UPDATE + mode);
+        leng = mkrec(rec, 1, bloblen(hp, NBLOBS));
+        off_t   size;
+
+        hxput(hp, rec, leng);
+        rc = hxdel(hp, rec);
+        ok(rc == leng, "hxdel returned blob length %d", rc);
+        size = lseek(hxfileno(hp), 0, SEEK_END);
+        hxput(hp, rec, leng);
+        ok(lseek(hxfileno(hp), 0, SEEK_END) == size,
+           "second blob reused freed pages");
+        hxclose(hp);
+
+        free(rec);
+        free(buf);
+    }
+
+    // A 2.2 file has no blob pages.
+    --hxversion;
+    rc = hxcreate("blob_t.hx", 0644, 1024, NULL, 0);
+    hp = hxopen("blob_t.hx", HX_UPDATE);
+    rec = malloc(maxlen);
+    leng = mkrec(rec, 0, hxmaxrec(hp) + 1);
+    rc = hxput(hp, rec, leng);
+    ok(rc == HXERR_BAD_REQUEST, "version 0x202 file rejects blob: %s",
+       hxerror(rc));
+    hxclose(hp);
+    ++hxversion;
+
+    // The key must fit in the part of the record kept in the chain.
+    rc = hxcreate("blob_t.hx", 0644, 1024, NULL, 0);
+    hp = hxopen("blob_t.hx", HX_UPDATE);
+    leng = mkrec(rec, 0, hxmaxrec(hp) + 1);
+    memset(rec, 'k', leng - 1);
+    rc = hxput(hp, rec, leng);
+    ok(rc == HXERR_BAD_RECORD, "blob key longer than the stub: %s",
+       hxerror(rc));
+    hxclose(hp);
+
+    // A blob hxput that fails after writing its blob pages frees
+    //  them. Every record is in page 1's chain. A deleted blob
+    //  leaves free pages; then the page before the chain's last
+    //  links back to the first overflow page, so hxput finds no
+    //  room and no end.
+    unsigned pg, prev = 0, first = 0, next;
+    off_t   size;
+
+    rc = hxcreate("blob_t.hx", 0644, 1024, NULL, 0);
+    hp = hxopen("blob_t.hx", HX_UPDATE);
+    hxbind(hp, samediff, samehash, NULL, NULL, anyrec);
+    for (i = 0; i < NSMALL / 2; ++i)
+        hxput(hp, rec, mkrec(rec, NBLOBS + i, 20));
+    leng = mkrec(rec, 1, bloblen(hp, 1));
+    hxput(hp, rec, leng);
+    hxdel(hp, rec);
+
+    for (pg = 1; pread(hxfileno(hp), &next, sizeof next, pg * 1024L) > 0
+         && next; pg = next)
+        prev = pg, first = first ? first : next;
+    pwrite(hxfileno(hp), &first, sizeof first, prev * 1024L);
+    size = lseek(hxfileno(hp), 0, SEEK_END);
+    rc = hxput(hp, rec, leng);
+    pwrite(hxfileno(hp), &pg, sizeof pg, prev * 1024L);
+    ok(rc == HXERR_BAD_FILE && blobpages(hp) == 0
+       && lseek(hxfileno(hp), 0, SEEK_END) == size,
+       "failed blob hxput left %d blob pages: %s", blobpages(hp),
+       hxerror(rc));
+    hxclose(hp);
+    free(rec);
+
+    return exit_status();
+}
@@ -30,7 +30,7 @@ main(void)
     int     ret, i;
     HXROOT  root = (HXROOT) { 2, 4, 0, 0 };
 
-    plan_tests(42);
+    plan_tests(55);
 
     setvbuf(stdout, 0, _IOLBF, 0);
     setvbuf(stderr, 0, _IOLBF, 0);
@@ -149,5 +149,118 @@ main(void)
         fclose(fp);
     }
 
+    // A version 1.0 file (no index fingerprints) is readable,
+    //  and is upgraded by repair.
+    ok(!hxcreate("upgrade_t.hx", 0644, PGSIZE, "ch", 2),
+       "hxcreate upgrade_t.hx");
+    fd = open("upgrade_t.hx", O_RDWR);
+    pwrite(fd, "\x00\x01", 2, offsetof(HXROOT, version));
+    close(fd);
+
+    hp = hxopen("upgrade_t.hx", HX_UPDATE);
+    memset(buf, '-', sizeof buf);
+    for (buf[0] = 'A'; buf[0] < 'S'; ++buf[0])
+        if (0 != (ret = hxput(hp, buf, sizeof buf)))
+            break;
+    hxclose(hp);
+
+    hp = hxopen("upgrade_t.hx", HX_REPAIR);
+    ret = hxfix(hp, NULL, 0, NULL, 0);
+    if (!ok(ret == (HXRET) HX_UPDATE && hp->version == 0x0100,
+            "hxfix accepts version 1.0 file"))
+        fprintf(stderr, "hxfix returned %s\n", hxmode(ret));
+
+    fp = tmpfile();
+    ret = hxfix(hp, fp, 0, NULL, 0);
+    if (!ok(ret == (HXRET) HX_UPDATE && hp->version == HXVERSION,
+            "hxfix upgrades version 1.0 file"))
+        fprintf(stderr, "hxfix returned %s\n", hxmode(ret));
+    fclose(fp);
+    hxclose(hp);
+
+    hp = hxopen("upgrade_t.hx", HX_READ);
+    for (buf[0] = 'A'; buf[0] < 'S'; ++buf[0])
+        if (sizeof buf != hxget(hp, buf, sizeof buf))
+            break;
+    ok(buf[0] == 'S' && hxfix(hp, NULL, 0, NULL, 0) == (HXRET) HX_UPDATE,
+       "upgraded file is clean, with %d/%d records", buf[0] - 'A', 'S' - 'A');
+    hxclose(hp);
+
+    // Version 1.1 pages full of small records are too full for
+    //  a version 2 hind[]; the upgrade moves records elsewhere.
+    ok(!hxcreate("upgrade_t.hx", 0644, PGSIZE, "", 0),
+       "hxcreate upgrade_t.hx");
+    fd = open("upgrade_t.hx", O_RDWR);
+    pwrite(fd, "\x01\x01", 2, offsetof(HXROOT, version));
+    close(fd);
+
+    hp = hxopen("upgrade_t.hx", HX_UPDATE);
+    for (i = 0; i < 500; ++i)
+        hxput(hp, buf, sprintf(buf, "%04d%cv", i, 0) + 1);
+    hxclose(hp);
+
+    hp = hxopen("upgrade_t.hx", HX_REPAIR);
+    fp = tmpfile();
+    ret = hxfix(hp, fp, 0, NULL, 0);
+    if (!ok(ret == (HXRET) HX_UPDATE && hp->version == HXVERSION,
+            "hxfix upgrades version 1.1 file"))
+        fprintf(stderr, "hxfix returned %s\n", hxmode(ret));
+    fclose(fp);
+    hxclose(hp);
+
+    hp = hxopen("upgrade_t.hx", HX_READ);
+    for (i = 0; i < 500; ++i)
+        if (sprintf(buf, "%04d%cv", i, 0) + 1 != hxget(hp, buf, sizeof buf))
+            break;
+    ok(i == 500 && hxfix(hp, NULL, 0, NULL, 0) == (HXRET) HX_UPDATE,
+       "upgraded file is clean, with %d/500 records", i);
+    hxclose(hp);
+
+    // 64-bit hashes: each record ends with the high half of its hash.
+    ok(!hxcreate("hash64_t.hx", 0644 | HX_HASH64, PGSIZE, "", 0),
+       "hxcreate hash64_t.hx");
+    hp = hxopen("hash64_t.hx", HX_UPDATE);
+    for (i = ret = 0; i < 500 && !ret; ++i)
+        ret = hxput(hp, buf, sprintf(buf, "%04d%cv", i, 0) + 1);
+    for (i = 0; i < 500 && !ret; i += 3) {
+        sprintf(buf, "%04d", i);
+        ret = hxdel(hp, buf) != 7;
+    }
+    for (i = 0; 7 == (ret = hxnext(hp, buf, sizeof buf)); ++i);
+    ok(!ret && i == 333 && hxfix(hp, NULL, 0, NULL, 0) == (HXRET) HX_UPDATE,
+       "64-bit hash file is clean, with %d/333 records", i);
+    hxclose(hp);
+
+    // Corrupt the high half of the first record's hash.
+    fd = open("hash64_t.hx", O_RDWR);
+    COUNT   leng;
+
+    pread(fd, &leng, sizeof leng, PGSIZE + sizeof(HXPAGE) + sizeof(HXHASH));
+    pwrite(fd, "?", 1, PGSIZE + sizeof(HXPAGE) + sizeof(HXREC) + leng - 1);
+    close(fd);
+
+    hp = hxopen("hash64_t.hx", HX_REPAIR);
+    ret = hxfix(hp, NULL, 0, NULL, 0);
+    ok(ret == (HXRET) HX_REPAIR, "hxcheck finds bad high hash: %s",
+       hxmode(ret));
+    fp = tmpfile();
+    ret = hxfix(hp, fp, 0, NULL, 0);
+    fclose(fp);
+    ok(ret == (HXRET) HX_UPDATE, "hxfix repairs it: %s", hxmode(ret));
+    hxclose(hp);
+
+    hp = hxopen("hash64_t.hx", HX_READ);
+    for (i = ret = 0; i < 500; ++i) {
+        sprintf(buf, "%04d", i);
+        ret += hxget(hp, buf, sizeof buf) == (i % 3 ? 7 : 0);
+    }
+    ok(ret == 500, "%d/500 records are as expected", ret);
+
+    // Without a "hash64" method, the file cannot be used.
+    hxbind(hp, hp->diff, hp->hash, hp->load, hp->save, hp->test);
+    ret = hxget(hp, strcpy(buf, "0001"), sizeof buf);
+    ok(ret == HXERR_BAD_REQUEST, "hxget without hash64: %s", hxerror(ret));
+    hxclose(hp);
+
     return exit_status();
 }
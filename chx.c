@@ -45,6 +45,7 @@ static void stats(HXFILE *);
 static void types(char const *dirs);
 
 static int mmode = 0;           // set to HX_MMAP by "-m".
+static int perms = 0644;        // HX_HASH64, HX_PGRATE added by "-w", "-r".
 static int verbose = 0;
 
 //--------------|---------------------------------------------
@@ -56,7 +57,7 @@ main(int argc, char **argv)
     int     timed = 0;
     char    cmd[10240];
 
-    while (0 < (opt = getopt(argc, argv, "?c:dmp:s:tv-"))) {
+    while (0 < (opt = getopt(argc, argv, "?c:dmp:r:s:tvw-"))) {
         switch (opt) {
 
         case '?':
@@ -71,6 +72,11 @@ main(int argc, char **argv)
         case 'm':
             mmode |= HX_MMAP;
             break;
+        case 'r':
+            if (!HX_PGRATE(atoi(optarg)) && atoi(optarg) != 4)
+                die("-r: page ratio must be 2, 4, 8 or 16");
+            perms |= HX_PGRATE(atoi(optarg));
+            break;
         case 's':
             mmode |= HX_FSYNC;
             break;
@@ -80,6 +86,9 @@ main(int argc, char **argv)
         case 'v':
             ++verbose;
             break;
+        case 'w':
+            perms |= HX_HASH64;
+            break;
         }
     }
 
@@ -104,7 +113,25 @@ main(int argc, char **argv)
 
     if (hxdebug)
         hxtime = tstart;
-    if (!strcmp(argv[0], "build")) {
+    if (!strcmp(argv[0], "autogrow")) {
+        int     fill;
+
+        if (argc != 3 || !sscanf(argv[2], "%d", &fill))
+            die("%s: requires fill percent arg (0 for none)", argv[0]);
+
+        hp = do_hxopen("autogrow", argv[1], HX_UPDATE);
+        is_hxret("autogrow", hxautogrow(hp, fill));
+
+    } else if (!strcmp(argv[0], "autoshrink")) {
+        int     low;
+
+        if (argc != 3 || !sscanf(argv[2], "%d", &low))
+            die("%s: requires low percent arg (0 for none)", argv[0]);
+
+        hp = do_hxopen("autoshrink", argv[1], HX_UPDATE);
+        is_hxret("autoshrink", hxautoshrink(hp, low));
+
+    } else if (!strcmp(argv[0], "build")) {
 
         hp = do_hxopen("build", argv[1], HX_UPDATE);
         fp = do_fopen("build", argv[2], "r");
@@ -135,10 +162,20 @@ main(int argc, char **argv)
 
         char const *type = argv[3] ? argv[3] : "";
 
-        is_hxret("create", hxcreate(argv[1], 0644, size, type, strlen(type)));
+        is_hxret("create", hxcreate(argv[1], perms, size, type, strlen(type)));
 
         hp = do_hxopen("create", argv[1], HX_RECOVER);
 
+    } else if (!strcmp(argv[0], "defrag")) {
+        int     moved, total = 0;
+
+        hp = do_hxopen("defrag", argv[1], HX_UPDATE);
+        while (0 < (moved = hxdefrag(hp, 1000)))
+            total += moved;
+        is_hxret("defrag", moved);
+        if (verbose)
+            printf("moved %d pages\n", total);
+
     } else if (!strcmp(argv[0], "del")) {
 
         hp = do_hxopen("del", argv[1], HX_UPDATE);
@@ -228,6 +265,21 @@ main(int argc, char **argv)
 
         types(getenv("LD_LIBRARY_PATH"));
         types("lib:/usr/lib");
+
+    } else if (!strcmp(argv[0], "upgrade")) {
+
+        hp = do_hxopen("upgrade", argv[1], HX_UPDATE);
+        if (hp->version == HXVERSION) {
+            if (verbose)
+                printf("%s: already version %#x\n", argv[1], HXVERSION);
+        } else {                // hxfix repair rewrites it in HXVERSION format
+            fp = tmpfile();
+            mode = hxfix(hp, fp, 0, NULL, 0);
+            if (verbose || mode != HX_UPDATE)
+                printf("%s %s\n", hxmode(mode), errno ? strerror(errno) : "");
+            ret = mode != HX_UPDATE;
+        }
+
     } else {
 
         die("%s: unknown command. See 'chx help'", cmd);
@@ -243,11 +295,18 @@ main(int argc, char **argv)
     return ret;
 }
 
+// del: delete keys in batches through hxdelv, which sorts
+//  each batch by chain. DELMEM bounds the memory for one batch.
+#define DELMEM  (64 << 20)
+#define DELKEYS (1 << 20)
+
 static void
 del(HXFILE * hp, FILE * fp)
 {
-    int     keysize = hxmaxrec(hp) + 1;
-    char    buf[keysize * 2], key[keysize];
+    int     keysize = hxmaxrec(hp) + 1, nkeys = 0;
+    char    buf[keysize * 2];
+    char   *mem = malloc(DELMEM), *memp = mem;
+    char const **keyv = malloc(DELKEYS * sizeof *keyv);
 
     while (fgets(buf, keysize * 2, fp)) {
         int     len = strlen(buf);
@@ -255,13 +314,21 @@ del(HXFILE * hp, FILE * fp)
         if (buf[len - 1] == '\n')
             buf[--len] = 0;
 
-        len = hx_load(hp, key, keysize, buf);
-        if (len <= 0)
+        if (nkeys == DELKEYS || memp + keysize > mem + DELMEM) {
+            is_hxret("del", hxdelv(hp, keyv, nkeys));
+            nkeys = 0, memp = mem;
+        }
+
+        len = hx_load(hp, memp, keysize, buf);
+        if (len <= 0 || len > keysize)
             continue;
-        is_hxret("del", hxdel(hp, key));
+        keyv[nkeys++] = memp;
+        memp += len;
     }
-    if (fp)
-        fclose(fp);
+
+    is_hxret("del", hxdelv(hp, keyv, nkeys));
+    free(keyv);
+    free(mem);
 }
 
 static FILE *
@@ -385,13 +452,18 @@ help()
           "\t-c N\tcore-dump after N write(2) calls\n"
           "\t-d\tenable hxdebug output (may be repeated)\n"
           "\t-m\tuse mmap file mode\n"
+          "\t-r N\tcreate: one overflow page per N pages (2,4,8,16)\n"
           "\t-s\tuse fsync file mode\n"
           "\t-t\treport elapsed time\n"
           "\t-v\tverbose diagnostics (may be repeated)\n"
+          "\t-w\tcreate: use 64-bit record hashes\n"
           "COMMANDS:\n"
+          "\tautogrow <hxfile> fill         Split when chains are fill% full\n"
+          "\tautoshrink <hxfile> low        Merge when chains are under low% full\n"
           "\tbuild  <hxfile> [text [memsize [inpsize]]] Populate hxfile from text\n"
           "\tcheck  <hxfile> [pgsize [type]]\n"
           "\tcreate <hxfile> pgsize [type]\n"
+          "\tdefrag <hxfile>                Move overflow pages next to their heads\n"
           "\tdel    <hxfile> [text]         Delete records for input keys\n"
           "\tdump   <hxfile>                Dump file dump (headers and data)\n"
           "\tfix    <hxfile> [pgsize [type]]\n"
@@ -405,10 +477,11 @@ help()
           "\tshape  <hxfile> density        Change file space/efficiency trade-off\n"
           "\tstat   <hxfile>                Show chain/share statisticss\n"
           "\ttypes                          List all accessible record type libraries\n"
+          "\tupgrade <hxfile>               Rewrite file in the current format\n"
           "'density' is a float between 0 and 9E9. 0 is fast, 9E9 is miminum size.\n"
           "\tTIt is the average number of overflow pages loaded\n"
           "\ton an unsuccessful look-up.\n"
-          "'memsize' is in MB. 'pgsize' is a power of 2 between 32 and 32768.\n"
+          "'memsize' is in MB. 'pgsize' is a power of 2 between 32 and 65536.\n"
           "'text' is a text file (or '-' for stdin) of save-format records.\n"
           "'type' is a typename, implemented by hx_<type>.so\n", stdout);
 
@@ -421,7 +494,7 @@ info(HXFILE * hp)
     HXSTAT  st;
 
     hxstat(hp, &st);
-    unsigned dpages = _hxf2d(st.npages);
+    unsigned dpages = _hxf2d(hp, st.npages);
     unsigned overs = st.npages - dpages - 1;
 
     if (!overs)
@@ -436,6 +509,12 @@ info(HXFILE * hp)
            st.head_bytes * 100 / DATASIZE(hp) / dpages,
            st.ovfl_bytes * 100 / DATASIZE(hp) / st.ovfl_pages, hp->pgsize);
 
+    if (GROW_FILL(hp))
+        printf(" autogrow=%d%%", GROW_FILL(hp));
+    if (SHRINK_FLOOR(hp))
+        printf(" autoshrink=%d%%", SHRINK_FLOOR(hp));
+    if (hp->pgrate != HXPGRATE)
+        printf(" pgrate=%d", hp->pgrate);
     if (hp->uleng)
         printf(" udata[%d]=%.*s", hp->uleng, hp->uleng, hp->udata);
     putchar('\n');
@@ -446,13 +525,13 @@ do_load(HXFILE * hp, FILE * inp)
 {
     HXRET   hxret = 0;
     int     reclen, recsize = hxmaxrec(hp);
-    int     bufsize = 2 * recsize;
-    char    rec[recsize], buf[bufsize];
+    char   *rec = malloc(recsize), *buf = NULL;
+    size_t  bufsize = 0;
     int     lineno = 0, more, added = 0;
 
     if (verbose == 1)
         setvbuf(stderr, NULL, _IONBF, 0);
-    while ((more = ! !fgets(buf, bufsize, inp))) {
+    while ((more = getline(&buf, &bufsize, inp) >= 0)) {
         ++lineno;
         char   *cp = buf + strlen(buf);
 
@@ -461,7 +540,12 @@ do_load(HXFILE * hp, FILE * inp)
         if (cp == buf)
             continue;
 
+        // A blob record may be longer than hxmaxrec.
         reclen = hx_load(hp, rec, recsize, buf);
+        if (reclen > recsize) {
+            rec = realloc(rec, recsize = reclen);
+            reclen = hx_load(hp, rec, recsize, buf);
+        }
         if (reclen <= 0) {
             fprintf(stderr, "# load: invalid %s: %s\n",
                     reclen == HXERR_BAD_REQUEST ? "request" : "input", buf);
@@ -488,6 +572,8 @@ do_load(HXFILE * hp, FILE * inp)
 
     if (verbose)
         fprintf(stderr, "load: in: %d added: %d\n", lineno, added);
+    free(rec);
+    free(buf);
 }
 
 static void
@@ -529,7 +615,7 @@ maps(HXFILE * hp)
     _hxsize(locp);
 
     last = locp->npages - 1;
-    last = _hxmap(hp, last - last % HXPGRATE, &bitpos);
+    last = _hxmap(hp, last - last % hp->pgrate, &bitpos);
     printf("last: mpg=%u bit=%d\n", (unsigned)last, bitpos);
 
     for (pg = 0; pg <= last;) {
@@ -544,7 +630,7 @@ maps(HXFILE * hp)
             unsigned b = bufp->data[i] & 0xFF;
 
             if (!(i & 15))
-                printf("\n%7u", (unsigned)pg + i * 8 * HXPGRATE);
+                printf("\n%7u", (unsigned)pg + i * 8 * hp->pgrate);
 
             if (i < bufp->used)
                 fputs(" >>", stdout);
@@ -553,7 +639,7 @@ maps(HXFILE * hp)
         }
         putchar('\n');
 
-        pg += (DATASIZE(hp) - bufp->used) * 8 * HXPGRATE;
+        pg += (DATASIZE(hp) - bufp->used) * 8 * hp->pgrate;
     }
 
     LEAVE(locp, 0);
@@ -565,12 +651,20 @@ do_save(HXFILE * hp, FILE * fp)
 {
     int     leng, maxrec = hxmaxrec(hp);
     int     strsize = 2 * maxrec;
-    char    rec[maxrec], str[strsize];
+    char   *rec = malloc(maxrec), *str = malloc(strsize);
 
     while (0 < (leng = hxnext(hp, rec, maxrec))) {
+        // A blob longer than (rec): hxnext copied its key.
+        if (leng > maxrec) {
+            rec = realloc(rec, maxrec = leng);
+            str = realloc(str, strsize = 2 * leng + 2);
+            leng = hxget(hp, rec, maxrec);
+        }
         hx_save(hp, rec, leng, str, strsize);
         fprintf(fp, "%s\n", str);
     }
+    free(rec);
+    free(str);
 }
 
 static void
@@ -591,6 +685,11 @@ stats(HXFILE * hp)
     for (i = 0; i <= n; ++i)
         printf(" %d", st.share_hist[i]);
 
+    printf("  Links: %.1f apart, %.0f%% back",
+           st.avg_link_dist, st.back_links * 100);
+    if (st.blob_recs)
+        printf("  Blobs: %.0f in %.0f pages", st.blob_recs, st.blob_pages);
+
     putchar('\n');
 }
 
@@ -0,0 +1,170 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// del_t: hxdelv and hxpurge bulk deletes, checked by hxget/hxfix.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap.h"
+
+#include "hx.h"
+
+#define NRECS   5000
+
+static char *
+mkrec(char *buf, int i)
+{
+    sprintf(buf, "k%05d", i);
+    sprintf(buf + 7, "value %d", i * 7919);
+    return buf;
+}
+
+static int
+reclen(char const *rec)
+{
+    return 7 + strlen(rec + 7) + 1;
+}
+
+// Purge by value content: even "value %d".
+static int
+is_even(char const *rec, int leng, void *ctx)
+{
+    int     hit = leng > 13 && !(atoi(rec + 13) % 2);
+
+    *(int *)ctx += hit;
+    return hit;
+}
+
+static int
+count(HXFILE * hp)
+{
+    char    buf[hxmaxrec(hp)];
+    int     n = 0;
+
+    while (hxnext(hp, buf, sizeof buf) > 0)
+        ++n;
+    hxrel(hp);
+    return n;
+}
+
+int
+main(void)
+{
+    HXRET   rc;
+    HXFILE *hp;
+    HXMODE  mode;
+    static char recs[NRECS][32];
+    char const *keyv[NRECS + 3];
+    int     i, nkeys, expect, missing;
+
+    plan_tests(2 * 16);
+    setvbuf(stdout, 0, _IOLBF, 0);
+
+    for (mode = 0; mode <= HX_MMAP; mode += HX_MMAP) {
+        rc = hxcreate("del_t.hx", 0644, 256, NULL, 0);
+        ok(HXOKAY == rc, "created del_t.hx: %s", hxerror(rc));
+
+        hp = hxopen("del_t.hx", HX_UPDATE + mode);
+        ok(hp, "opened del_t.hx with %s", hxmode(HX_UPDATE + mode));
+
+        for (i = 0; i < NRECS; ++i) {
+            mkrec(recs[i], i);
+            if (0 > (rc = hxput(hp, recs[i], reclen(recs[i]))))
+                break;
+        }
+        ok(i == NRECS, "inserted %d/%d records: %s", i, NRECS, hxerror(rc));
+
+        // Delete two of every three records, plus one duplicate
+        //  key and two keys that are not in the file.
+        for (i = nkeys = 0; i < NRECS; ++i)
+            if (i % 3)
+                keyv[nkeys++] = recs[i];
+        expect = nkeys;
+        keyv[nkeys++] = recs[1];
+        keyv[nkeys++] = "nosuchkey";
+        keyv[nkeys++] = "k99999";
+
+        rc = hxdelv(hp, keyv, nkeys);
+        ok(rc == expect, "hxdelv deleted %d/%d records", rc, expect);
+
+        for (i = missing = 0; i < NRECS; ++i) {
+            char    buf[32];
+
+            strcpy(buf, recs[i]);
+            missing += !(i % 3) != (hxget(hp, buf, sizeof buf) > 0);
+        }
+        ok(missing == 0, "%d records misplaced by hxdelv", missing);
+        ok(count(hp) == NRECS - expect, "hxnext finds survivors");
+
+        rc = hxdelv(hp, NULL, 1);
+        ok(rc == HXERR_BAD_REQUEST, "hxdelv rejects null vector: %s",
+           hxerror(rc));
+
+        int     purged = 0;
+
+        rc = hxpurge(hp, is_even, &purged);
+        expect = (NRECS + 5) / 6;
+        ok(rc == expect, "hxpurge deleted %d/%d records", rc, expect);
+        ok(purged == rc, "predicate matched %d records", purged);
+
+        for (i = missing = 0; i < NRECS; i += 3) {
+            char    buf[32];
+
+            strcpy(buf, recs[i]);
+            missing += !(i % 2) != !(hxget(hp, buf, sizeof buf) > 0);
+        }
+        ok(missing == 0, "%d records misplaced by hxpurge", missing);
+
+        rc = hxpurge(hp, NULL, NULL);
+        ok(rc == HXERR_BAD_REQUEST, "hxpurge rejects null fn: %s",
+           hxerror(rc));
+
+        // Delete the rest; every overflow page is freed.
+        for (i = 3, nkeys = 0; i < NRECS; i += 6)
+            keyv[nkeys++] = recs[i];
+        rc = hxdelv(hp, keyv, nkeys);
+        ok(rc == nkeys, "hxdelv deleted remaining %d/%d records", rc, nkeys);
+        ok(count(hp) == 0, "file is empty");
+
+        // Reloading reuses the freed overflow pages.
+        off_t   size = lseek(hxfileno(hp), 0, SEEK_END);
+
+        for (i = 0; i < NRECS; ++i)
+            if (0 > (rc = hxput(hp, recs[i], reclen(recs[i]))))
+                break;
+        ok(i == NRECS && lseek(hxfileno(hp), 0, SEEK_END) == size,
+           "reloaded %d records in %lld bytes: %s", i,
+           (long long)lseek(hxfileno(hp), 0, SEEK_END), hxerror(rc));
+
+        hxclose(hp);
+
+        hp = hxopen("del_t.hx", HX_READ);
+        rc = hxfix(hp, 0, 0, 0, 0);
+        ok(rc == (HXRET) HX_UPDATE, "file not corrupted: %s", hxmode(rc));
+
+        rc = hxdelv(hp, keyv, nkeys);
+        ok(rc == HXERR_BAD_REQUEST, "hxdelv rejects read-only file: %s",
+           hxerror(rc));
+        hxclose(hp);
+    }
+
+    return exit_status();
+}
@@ -29,16 +29,32 @@ main(void)
     setvbuf(stdout, 0, _IOLBF, 0);
 
     struct { PAGENO inp, exp; } try_split[] = {
-        {2,1}, {3,1}, {4,2}, {5,1}, {6,2}, {7,3}
+        {2,0}, {3,1}, {4,0}, {5,1}, {6,2}, {7,3}
     };
     int i, ntry_split = sizeof try_split/sizeof*try_split;
+    HXFILE hx = { .pgrate = HXPGRATE, .pgshift = 2 };
 
-    plan_tests(ntry_split);
+    plan_tests(ntry_split + 4);
 
     for (i = 0; i < ntry_split; ++i) {
-        PAGENO act = _hxf2d(SPLIT_LO(_hxd2f(try_split[i].inp)));
+        PAGENO act = _hxf2d(&hx, SPLIT_LO(&hx, _hxd2f(&hx, try_split[i].inp)));
         is(act, try_split[i].exp, "SPLIT_LO(%d)", try_split[i].inp);
     }
 
+    // Each ratio: heads are numbered in order, skipping every
+    //  (pgrate)th page.
+    for (hx.pgshift = 1; hx.pgshift <= 4; ++hx.pgshift) {
+        PAGENO pg, dp = 0;
+
+        hx.pgrate = 1 << hx.pgshift;
+        for (pg = 1; pg < 100000; ++pg) {
+            if (!IS_HEAD(&hx, pg) != (pg % hx.pgrate == 0)
+                || (IS_HEAD(&hx, pg) && (_hxf2d(&hx, pg) != dp
+                                        || _hxd2f(&hx, dp++) != pg)))
+                break;
+        }
+        is(pg, 100000, "pgrate %d: head page numbering", hx.pgrate);
+    }
+
     return exit_status();
 }
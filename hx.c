@@ -25,6 +25,9 @@
 #include <stdarg.h>
 #include <sys/time.h>
 #include "util.h"               // fls
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
 
 int     hxcrash;
 int     hxdebug;
@@ -35,13 +38,19 @@ int     hxversion = HXVERSION;
 int
 hx_diff(HXFILE const *hp, char const *reca, char const *recb)
 {
-    return hp->diff(reca, recb, hp->udata, hp->uleng);
+    return KIT_DIFF(hp, reca, recb);
 }
 
 HXHASH
 hx_hash(HXFILE const *hp, char const *recp)
 {
-    return hp->hash(recp, hp->udata, hp->uleng);
+    return KIT_HASH(hp, recp);
+}
+
+HXHASH64
+hx_hash64(HXFILE const *hp, char const *recp)
+{
+    return KIT_HASH64(hp, recp);
 }
 
 int
@@ -52,7 +61,8 @@ hx_load(HXFILE const *hp, char *recp, int recsize, char const *buf)
 
     int     rc = hp->load(recp, recsize, buf, hp->udata, hp->uleng);
 
-    return rc > 0 && rc <= hxmaxrec(hp) ? rc : HXERR_BAD_RECORD;
+    return rc > 0 && (rc <= hxmaxrec(hp) || HAS_BLOBS(hp))
+        ? rc : HXERR_BAD_RECORD;
 }
 
 int
@@ -88,7 +98,10 @@ hxinfo(HXFILE const *hp, char *udata, int usize)
 int
 hxmaxrec(HXFILE const *hp)
 {
-    return hp ? (int)(DATASIZE(hp) - sizeof(HXREC) - MIN_INDEX_BYTES(1))
+    // In-page (leng) must leave REC_BLOB clear: this only
+    //  limits 64K pages.
+    return hp ? IMIN(DATASIZE(hp) - sizeof(HXREC) - MIN_INDEX_BYTES(hp, 1),
+                     REC_BLOB - 1) - HASH_TAIL(hp)
         : HXERR_BAD_REQUEST;
 }
 
@@ -104,13 +117,13 @@ _hxenter(HXLOCAL * locp, HXFILE * hp, char const *recp, int nbufs)
     // The following must be set before any LEAVE:
     locp->file = hp;
 
-    if (!hp || !hp->diff || !hp->hash)
+    if (!hp || !hp->diff || !hp->hash || (HASH_TAIL(hp) && !hp->hash64))
         LEAVE(locp, HXERR_BAD_REQUEST);
 
     locp->mode = F_WRLCK;       // the common case
     errno = 0;
     if (recp)
-        locp->hash = hx_hash(hp, recp);
+        locp->hash = _hxhash(hp, recp);
 
     // THIS SHOULD NOT BE HERE!
     if (!IS_MMAP(hp) && nbufs) {
@@ -125,74 +138,171 @@ _hxenter(HXLOCAL * locp, HXFILE * hp, char const *recp, int nbufs)
 // _hxfind: search buffer for match against given key.
 //  Returns (-1), or offset in data[] of HXREC matching (rp).
 // *hindp is the hash table position, for incremental hind changes.
+// Where the page has fingerprints, a record is only examined
+//  if its fingerprint matches; SSE2 tests 16 slots at a time.
+// In a RH_HIND page, a miss stops at the first entry nearer its
+//  home than the key would be: that is checked for every record
+//  examined, and for the last slot of each 16-slot block.
 int
-_hxfind(HXLOCAL * locp, HXBUF const *bufp, HXHASH rechash,
+_hxfind(HXLOCAL * locp, HXBUF const *bufp, HXHASH64 rechash,
         char const *recdata, int *hindp)
 {
     HXFILE const *hp = locp->file;
     COUNT const *hind = HIND_BASE_C(hp, bufp);
     int     hsize = HIND_SIZE(hp, bufp);
+    BYTE const *fing = HIND_FING(hp, bufp, hind, hsize);
+    BYTE    f = FINGER(rechash);
     unsigned mask = MASK(hsize);
-    int     i = rechash & mask;
+    int     home = HIND_HOME(rechash, mask, hsize), i = home;
+    int     rh = RH_HIND(hp), found = 0;
+
+#   define NEARER(i) (HIND_DIST(HIND_HOME(RECHASH(bufp->data + hind[-(i)] - 1), \
+                                          mask, hsize), i, hsize) \
+                      < HIND_DIST(home, i, hsize))
+#ifdef __SSE2__
+    __m128i vf = _mm_set1_epi8(f), v0 = _mm_setzero_si128();
+#endif
 
-    if (i >= hsize)
-        i &= mask >> 1;
+    while (1) {
+#ifdef __SSE2__
+        // Slots (i .. i-15) are the 16 bytes from fing[-i] up.
+        if (fing && i >= 15) {
+            __m128i v = _mm_loadu_si128((__m128i const *)(fing - i));
+            unsigned hit = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vf));
+            unsigned end = _mm_movemask_epi8(_mm_cmpeq_epi8(v, v0));
+            int     j = i;
+
+            for (hit &= (end & -end) - 1; hit; hit &= hit - 1) {
+                char const *recp =
+                    bufp->data + hind[-(j = i - __builtin_ctz(hit))] - 1;
+
+                if (rechash == RECHASH64(hp, recp)
+                    && !KIT_DIFF(hp, recdata, RECDATA(recp)))
+                    break;
+            }
+
+            if (hit || end) {
+                found = !!hit;
+                i = hit ? j : i - __builtin_ctz(end);
+                break;
+            }
+
+            if (rh && NEARER(i - 15)) {
+                i -= 15;
+                break;
+            }
+
+            i = i > 15 ? i - 16 : hsize - 1;
+            continue;
+        }
+#endif
+        if (!hind[-i])
+            break;
 
-    for (; hind[-i]; i = (i ? i : hsize) - 1) {
         char const *recp = bufp->data + hind[-i] - 1;
 
-        if (rechash == RECHASH(recp) && !hx_diff(hp, recdata, RECDATA(recp)))
-            break;
+        if (!fing || fing[-i] == f) {
+            if (rechash == RECHASH64(hp, recp)
+                && !KIT_DIFF(hp, recdata, RECDATA(recp))) {
+                found = 1;
+                break;
+            }
+            if (rh && NEARER(i))
+                break;
+        }
+
+        i = (i ? i : hsize) - 1;
     }
+#   undef NEARER
+
     if (hindp)
         *hindp = i;
-    return hind[-i] - 1;
+    return found ? hind[-i] - 1 : -1;
 }
 
 // _hxhead: calculate pgno of head-of-chain for a given record hash.
-//  This first reverses the hash, since the low bits of the hash
-//  are now used for in-page indexing.
+//  This uses the high 32 bits, reversed, since the low bits of the
+//  hash are used for in-page indexing.
 PAGENO
-_hxhead(HXLOCAL const *locp, HXHASH hash)
+_hxhead(HXLOCAL const *locp, HXHASH64 hash)
 {
-    PAGENO  pg = REV_HASH(hash) & locp->mask;
+    PAGENO  pg = REV_HASH(hash >> 32) & locp->mask;
 
-    return _hxd2f(pg < locp->dpages ? pg : pg & (locp->mask >> 1));
+    return _hxd2f(locp->file,
+                  pg < locp->dpages ? pg : pg & (locp->mask >> 1));
 }
 
 // _hxindexed: test that hind[] is correct.
-//  - every record is indexed
-//  - the rest of hind[] is zero
+//  - every entry is the offset(+1) of a distinct record
+//  - every record is on the probe path from its home slot
+//  - fingerprints are zero exactly where hind[] is
+//  - at least one entry is zero; _hxfind relies on that.
+// This does not require the layout that _hxindexify would make.
 int
 _hxindexed(HXLOCAL * locp, HXBUF const *bufp)
 {
-    COUNT const *hind = HIND_BASE_C(locp->file, bufp);
-    int     hsize = HIND_SIZE(locp->file, bufp);
-    COUNT   test[hsize], *tend = test + hsize - 1;
-
-    memcpy(test, hind - hsize + 1, hsize * sizeof(COUNT));
-
-    // Ensure that there are at least hsize/4 zeroes in hind[]:
-    //  _hxfind relies on there being at least 1 zero!
+    HXFILE const *hp = locp->file;
+    COUNT const *hind = HIND_BASE_C(hp, bufp);
+    int     hsize = HIND_SIZE(hp, bufp);
+    BYTE const *fing = HIND_FING(hp, bufp, hind, hsize);
+    BYTE    isrec[bufp->used + 1];
+    char const *recp, *endp;
+    int     i, nents = 0;
 
-    int     i = 0, hpos = bufp->recs / 4;
+    // Every entry must point at a record; hxget trusts them.
+    memset(isrec, 0, sizeof isrec);
+    FOR_EACH_REC(recp, bufp, endp)
+        isrec[recp - bufp->data] = 1;
 
-    while (i < hsize && hpos > 0)
-        hpos -= !test[i++];
-    if (i == hsize)
+    for (i = 0; i < hsize; ++i) {
+        if (hind[-i] > bufp->used || (hind[-i] && !isrec[hind[-i] - 1])
+            || (fing && !fing[-i] != !hind[-i]))
+            return 0;
+        nents += !!hind[-i];
+    }
+    if (nents != bufp->recs || nents >= hsize)
         return 0;
 
-    char const *recp, *endp;
+    // Each record must be reachable from its home slot, without
+    //  crossing an empty slot. Unlike _hxfind, this does not
+    //  trip over duplicate keys, which are bad_dup_recs' business.
+    unsigned mask = MASK(hsize);
 
     FOR_EACH_REC(recp, bufp, endp) {
-        if (0 > _hxfind(locp, bufp, RECHASH(recp), RECDATA(recp), &hpos))
+        HXHASH  hash = RECHASH(recp);
+        COUNT   pos = recp - bufp->data + 1;
+
+        for (i = HIND_HOME(hash, mask, hsize);
+             hind[-i] != pos; i = (i ? i : hsize) - 1)
+            if (!hind[-i])
+                return 0;
+
+        if (fing && fing[-i] != FINGER(hash))
             return 0;
-        tend[-hpos] = 0;
     }
 
-    for (i = 0; i < hsize; ++i)
-        if (tend[-i])
-            return 0;
+    // Robin Hood order: going down a run, an entry is at most one
+    //  slot further from home than the entry above it.
+    if (RH_HIND(hp)) {
+        for (i = 0; i < hsize; ++i) {
+            int     p = i == hsize - 1 ? 0 : i + 1;
+            int     dist, pdist;
+
+            if (!hind[-i])
+                continue;
+            recp = bufp->data + hind[-i] - 1;
+            dist = HIND_DIST(HIND_HOME(RECHASH(recp), mask, hsize), i, hsize);
+            if (!hind[-p]) {
+                if (dist)
+                    return 0;
+                continue;
+            }
+            recp = bufp->data + hind[-p] - 1;
+            pdist = HIND_DIST(HIND_HOME(RECHASH(recp), mask, hsize), p, hsize);
+            if (dist > pdist + 1)
+                return 0;
+        }
+    }
 
     return 1;
 }
@@ -229,16 +339,25 @@ _hxleave(HXLOCAL * locp)
         && locp->ret >= HXOKAY && fsync(hp->fileno))
         locp->ret = HXERR_FSYNC;
 
+    free(locp->delv);
+    free(locp->freev);
+    free(locp->blobv);
     free(locp->vnext);
     free(locp->vprev);
     free(locp->vrefs);
     free(locp->visit);
+    free(locp->vblob);
+    free(locp->seen);
+    free(locp->scanbuf);
     free(locp->vtail);
     free(locp->recv);
     free(locp->membase);
+    free(locp->ovfv);
 
     if (locp->tmpmap)
         munmap(locp->tmpmap, locp->mapsize);
+    if (locp->inpmap)
+        munmap(locp->inpmap, locp->inplen);
 
     for (i = locp->nfps; --i >= 0;)
         fclose(locp->fp[i]);
@@ -267,7 +386,7 @@ _hxload(HXLOCAL * locp, HXBUF * bufp, PAGENO pgno)
            (locp->buf[2].page && locp->buf[2].pgno == pgno &&
             DIRTY(&locp->buf[2])));
 
-    if (!IS_HEAD(pgno))
+    if (!IS_HEAD(hp, pgno))
         _hxlock(locp, pgno, 1);
     if (!hp->hold && !_hxislocked(locp, pgno)) {
         DEBUG("no lock guarding pgno=%d", pgno);
@@ -302,7 +421,7 @@ _hxload(HXLOCAL * locp, HXBUF * bufp, PAGENO pgno)
 
     if (!(hp->mode & HX_RECOVER) && ((bufp->used > DATASIZE(hp))
                                      || (pgno && bufp->next && !bufp->used)
-                                     || (pgno && IS_HEAD(bufp->next))
+                                     || (pgno && IS_HEAD(hp, bufp->next))
                                      || (IS_MAP(hp, pgno) &&
                                          !(bufp->data[bufp->used] & 1))
         ))
@@ -316,17 +435,17 @@ _hxmap(HXFILE const *hp, PAGENO pgno, int *bitpos)
 {
     PAGENO  mpg = 0, ppm;
 
-    assert(!IS_HEAD(pgno));
+    assert(!IS_HEAD(hp, pgno));
 
     if (pgno < hp->map1) {
 
-        *bitpos = pgno / HXPGRATE + 8 * hp->uleng;
+        *bitpos = (pgno >> hp->pgshift) + 8 * hp->uleng;
 
     } else {
 
-        ppm = 8 * HXPGRATE * DATASIZE(hp);
+        ppm = 8 * hp->pgrate * DATASIZE(hp);
         mpg = pgno - (pgno - hp->map1) % ppm;
-        *bitpos = (pgno - mpg) / HXPGRATE % ppm;
+        *bitpos = ((pgno - mpg) >> hp->pgshift) % ppm;
         DEBUG3("pgno=%u: %u %u", pgno, mpg, *bitpos);
     }
     DEBUG3("pgno=%u maps to mpg=%u off=%u bit=%u",
@@ -335,14 +454,17 @@ _hxmap(HXFILE const *hp, PAGENO pgno, int *bitpos)
 }
 
 // _hxpginfo: read the {next,used} page header (only).
-//  Currently only of use to "hxshare", which forbids MMAP.
+//  An mmap'd header is read in place, without a syscall.
 PGINFO
 _hxpginfo(HXLOCAL * locp, PAGENO pg)
 {
+    HXFILE *hp = locp->file;
     PGINFO  info;
 
-    assert(!locp->file->mmap);
-    _hxread(locp, (off_t) pg * locp->file->pgsize, &info, sizeof info);
+    if (hp->mmap)
+        memcpy(&info, &hp->mmap[(off_t) pg * hp->pgsize], sizeof info);
+    else
+        _hxread(locp, (off_t) pg * hp->pgsize, &info, sizeof info);
     return (PGINFO) {
     LDUL(&info.pgno), LDUS(&info.used), LDUS(&info.recs)};
 }
@@ -435,7 +557,7 @@ _hxsize(HXLOCAL * locp)
     PAGENO npages = locp->npages, split = SPLIT_PAGE(locp);
 
     locp->npages = size;
-    locp->dpages = _hxf2d(locp->npages);
+    locp->dpages = _hxf2d(hp, locp->npages);
     locp->mask = MASK(locp->dpages);
 
     if (npages && npages != locp->npages)
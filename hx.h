@@ -31,9 +31,10 @@
 #include <stdint.h>
 #include <stdio.h>              // required by hxfix
 
-#define HXVERSION 0x0100
+#define HXVERSION 0x0203
 
 typedef uint32_t HXHASH;
+typedef uint64_t HXHASH64;
 typedef struct hxfile HXFILE;
 
 typedef enum {
@@ -49,6 +50,13 @@ typedef enum {
     HX_REPAIR = HX_RECOVER + HX_UPDATE
 } HXMODE;
 
+// hxcreate "perms" bit: records carry 64-bit hashes.
+#define HX_HASH64 0x10000
+// hxcreate "perms" bits: one overflow page per (r) pages, where
+//  (r) is 2, 4 (the default), 8 or 16.
+#define HX_PGRATE(r) ((r) == 2 ? 0x20000 : (r) == 8 ? 0x40000 \
+                      : (r) == 16 ? 0x60000 : 0)
+
 // HXRET: enum of return codes from hx api functions.
 // READ,LSEEK,... are all for the corresponding syscalls.
 //  dlopen is only called by hxopen, which returns NULL
@@ -82,6 +90,7 @@ typedef enum { HXOKAY, HXNOTE, HXERRS } HXRET;
 //
 // HX_DIFF_FN: returns 0 if two records are the same.
 // HX_HASH_FN: returns 32bit hash.
+// HX_HASH64_FN: returns 64bit hash. Required for HX_HASH64 files.
 // HX_SAVE_FN: returns the number of bytes required to hold
 //              the record in string format (may exceed bufsize).
 // HX_LOAD_FN: returns the number of bytes required to hold
@@ -93,6 +102,9 @@ typedef int (*HX_DIFF_FN) (char const *arec, char const *brec,
 
 typedef HXHASH(*HX_HASH_FN) (char const *recp, char const *udata, int uleng);
 
+typedef HXHASH64(*HX_HASH64_FN) (char const *recp, char const *udata,
+                                 int uleng);
+
 typedef int (*HX_LOAD_FN) (char *recp, int recsize,
                            char const *buf, char const *udata, int uleng);
 
@@ -103,12 +115,24 @@ typedef int (*HX_SAVE_FN) (char const *recp, int reclen,
 typedef int (*HX_TEST_FN) (char const *recp, int reclen,
                            char const *udata, int uleng);
 
+// HX_PURGE_FN: returns nonzero if hxpurge should delete the record.
+typedef int (*HX_PURGE_FN) (char const *recp, int reclen, void *ctx);
+
+// HX_SCAN_FN: returns nonzero to stop an hxscan* call.
+typedef int (*HX_SCAN_FN) (char const *recp, int reclen, void *ctx);
+
+// HXCURSOR: where hxscan_from stopped; see hxscan_from.
+typedef struct {
+    unsigned char pos[8];
+} HXCURSOR;
+
 typedef enum { DIFF, HASH, LOAD, SAVE, TEST } HXFUNC;
 
 #define HX_MIN_PGSIZE    32
-#define HX_MAX_PGSIZE 32768
+#define HX_MAX_PGSIZE 65536
 #define	HX_MAX_CHAIN     20
 #define	HX_MAX_SHARE    100
+#define	HX_MAX_PARTS  65536
 
 typedef struct {
     double  nrecs;
@@ -125,6 +149,14 @@ typedef struct {
     unsigned chain_hist[HX_MAX_CHAIN + 1];
     // histogram of multi-chain tails
     unsigned share_hist[HX_MAX_SHARE + 1];
+    // chain locality: mean |next - pgno| over overflow links,
+    //  and the fraction of those links that point backwards.
+    double  avg_link_dist;
+    double  back_links;
+    // blobs: records longer than hxmaxrec, and their pages.
+    double  blob_recs;
+    double  blob_pages;
+    double  blob_bytes;
 
 } HXSTAT;
 
@@ -151,21 +183,59 @@ extern FILE *hxlog;
 void    hxbind(HXFILE *, HX_DIFF_FN, HX_HASH_FN,
                HX_LOAD_FN, HX_SAVE_FN, HX_TEST_FN);
 
+// hxbind64: supply the 64-bit hash method manually.
+void    hxbind64(HXFILE *, HX_HASH64_FN);
+
+// hxautogrow: make hxput split a head page whenever chains hold,
+//  on average, more than (fill) percent (1..127) of a page of
+//  records. (fill) is stored in the file; 0 turns the policy off.
+//  Other handles see the change when they are (re)opened.
+HXRET   hxautogrow(HXFILE *, int fill);
+
+// hxautoshrink: make hxput/hxdel merge the last head page back into
+//  the head it was split from, whenever chains hold on average less
+//  than (low) percent (1..63) of a page. (low) must be below
+//  the hxautogrow fill; 0 turns the policy off.
+HXRET   hxautoshrink(HXFILE *, int low);
+
 // hxbuild: bulk-load an empty hxfile.
+//  If "inp" is a regular file, it is read through mmap.
 //  If "inp" is a stream, supplying a nonzero "inpsize"
 //  saves a third write/read pass through the input.
+//  hxbuild does not make blobs: input records longer than
+//  hxmaxrec are rejected.
 HXRET   hxbuild(HXFILE *, FILE *, int memlimit, double inpsize);
 
 void    hxclose(HXFILE * hp);
 
 // hxcreate: initialize a hx file.
-//  "pgsize" must be a power of 2.
+//  "pgsize" must be a power of 2, HX_MIN_PGSIZE to HX_MAX_PGSIZE.
 //  "udata" is "uleng" bytes of optional data written into the
 //  root page of the created file, usable by wrappers using hx.
 //  (data,leng) is passed to every "diff" and "hash" call.
+//  "perms" may include HX_HASH64: each record then stores a 64-bit
+//  hash (4 more bytes), from the record type's "hash64" method.
+//  The high bits choose the head page; the low bits, the
+//  in-page slot. That keeps full-hash collisions within a chain
+//  (each one an hx_diff call) rare in files of billions of keys.
+//  "perms" may include HX_PGRATE(r). Small records that hash evenly
+//  rarely overflow, and waste fewer pages with a ratio of 8 or 16;
+//  skewed keys need more overflow pages, e.g. a ratio of 2.
 HXRET   hxcreate(char const *name, int perms, int pgsize,
                  char const *udata, int uleng);
 
+// hxdefrag: move overflow pages nearer to their chain heads,
+//  in ascending order, locking one chain at a time. Moves about
+//  (budget) pages per call, resuming where the last call stopped.
+//  Returns the number of pages moved; 0 when a pass is done.
+HXRET   hxdefrag(HXFILE *, int budget);
+
+// hxdelv: delete records matching any of nrecs keys.
+//  Cheaper than hxdel per key: each chain is compacted once.
+//  Holds a lock on the whole file for the duration of the call.
+//  Returns the number of records deleted.
+HXRET   hxdelv(HXFILE *, char const *const *recv, int nrecs);
+
 // hxerror: name-string for HXRET code
 char const *hxerror(HXRET);
 
@@ -199,9 +269,15 @@ int     hxget(HXFILE *, char *recp, int size);
 int     hxinfo(HXFILE const *hp, char *udata, int usize);
 
 // hxlib: dynamic load of a hx type, returning lib path.
+//  Types "bin<N>" (N-byte binary key) and "binv" (key is a
+//  length byte plus that many bytes) are built in: no library
+//  is loaded, and the path returned is NULL. See hxbin.c.
 int     hxlib(HXFILE *, char const *hxreclib, char **pathp);
 
-// hxmaxrec: return max allowed hxput "leng" value.
+// hxmaxrec: return max "leng" of a record stored in one page.
+//  A version 2.3 file takes longer records (up to 2GB) as blobs,
+//  whose key must lie in the first hxmaxrec/8 BYTEs; hxbuild
+//  and hxput during hxnext do not.
 int     hxmaxrec(HXFILE const *hp);
 
 // hxmode: name-string for hxopen mode bits
@@ -226,19 +302,77 @@ int     hxnext(HXFILE *, char *recp, int size);
 //      HX_MPROTECT mprotect mmap'd file outside API calls.
 HXFILE *hxopen(char const *name, HXMODE);
 
+// hxpurge: delete every record for which fn(rec,leng,ctx) != 0.
+//  Chains are locked, purged and compacted one at a time.
+//  Returns the number of records deleted.
+HXRET   hxpurge(HXFILE *, HX_PURGE_FN, void *ctx);
+
 // hxput: insert/update a record.
 //  Returns length of replaced record, or zero.
+//  A blob hxput (leng > hxmaxrec) locks the whole file.
 HXRET   hxput(HXFILE *, char const *recp, int leng);
 
 // hxrel: release lock by hxhold or hxnext
 HXRET   hxrel(HXFILE *);
 
+// hxreserve: size a file for (nrecs) records averaging
+//  (avg_reclen) bytes, so that loading them does not split
+//  pages. The whole file is locked while it is resized once
+//  and each new head is split in place. Until the last split,
+//  some records are in chains that lookups no longer search:
+//  a crash part way leaves them for hxfix to put back.
+//  Returns the number of pages added (0 if already that big).
+HXRET   hxreserve(HXFILE *, double nrecs, int avg_reclen);
+
+// hxscan: call fn(rec,leng,ctx) for each record, in page order,
+//  until fn returns nonzero. The whole file is held with a shared
+//  lock for the call; fn must not call hx functions on (hp). With
+//  HX_MMAP, (rec) points into the mapped file, and is only valid
+//  during the call to fn.
+//  Returns the number of records passed to fn.
+int     hxscan(HXFILE *, HX_SCAN_FN, void *ctx);
+
+// hxscan_from: hxscan_live in slices. A zeroed HXCURSOR starts a
+//  scan. Each call passes fn records from (*cursor) until (budget)
+//  have been passed and the chain it is in is done, and updates
+//  (*cursor) for the next call; it returns 0 once the scan is done.
+//  An HXCURSOR is a plain byte string: it can be saved, or passed
+//  to another process, and stays valid as the file changes size.
+//  If fn stops the scan, the next call repeats that chain, so
+//  each record is passed at least once.
+int     hxscan_from(HXFILE *, HXCURSOR *, int budget, HX_SCAN_FN,
+                    void *ctx);
+
+// hxscan_live: hxscan that locks one chain at a time, so that
+//  writers can proceed, in hash order. A record in the file for
+//  the whole scan is passed once, even if the file grows or shrinks;
+//  a record changed during the scan may or may not be. fn is called
+//  with the record's chain locked, and must not call hx functions
+//  on (hp). Returns the number of records passed to fn.
+int     hxscan_live(HXFILE *, HX_SCAN_FN, void *ctx);
+
+// hxscan_part: call fn(rec,leng,ctx) for each record of partition
+//  (part) of (nparts), until fn returns nonzero. A record's
+//  partition is fixed by its hash, so partitions scanned at the
+//  same time (by processes, or threads with their own HXFILE)
+//  return each record once. The whole file is held with a shared
+//  lock for the call; fn must not call hx functions on (hp).
+//  Returns the number of records passed to fn.
+int     hxscan_part(HXFILE *, int part, int nparts, HX_SCAN_FN, void *ctx);
+
 // hxshape: expand or pack a file to a given efficiency.
 //  overload=0.0 means NO overflow pages are used.
 //  overload>0 means that, on average, an unsuccessful
 //  lookup will read (overload + 1) pages.
 HXRET   hxshape(HXFILE * hp, double overload);
 
+// hxshape_step: hxshape a little at a time: about (budget)
+//  pages are added to or trimmed from the file, a few at a time,
+//  locking only the pages involved, so that other processes
+//  can keep using the file. Returns the number of pages added
+//  or trimmed; 0 means there is nothing (simple) left to do.
+HXRET   hxshape_step(HXFILE * hp, double overload, int budget);
+
 // hxstat: report statistics:
 HXRET   hxstat(HXFILE *, HXSTAT *);
 
@@ -247,6 +381,9 @@ int     hx_diff(HXFILE const *, char const *ra, char const *rb);
 
 HXHASH  hx_hash(HXFILE const *, char const *rp);
 
+// hx_hash64: the "hash64" method; else (hash:hash).
+HXHASH64 hx_hash64(HXFILE const *, char const *rp);
+
 int     hx_load(HXFILE const *, char *rp, int size, char const *buf);
 int     hx_save(HXFILE const *, char const *rp, int recleng,
                 char *buf, int bufsize);
@@ -22,36 +22,24 @@
 //  External: "key\tval\0"
 #include <string.h>
 #include "hx_.h"
+#include "hxkit_.h"
 
 int
 diff(char const *ap, char const *bp, char const *udata, int uleng)
 {
-    (void)udata, (void)uleng;
-    while (1) {
-        if (*ap != *bp)
-            return 1;
-        if (*ap == 0)
-            return 0;
-        ++ap, ++bp;
-    }
+    return hxkit_diff(ap, bp, udata, uleng);
 }
 
 HXHASH
 hash(char const *recp, char const *udata, int uleng)
 {
-    (void)udata, (void)uleng;
-    HXHASH  ret = 2166136261U;
-
-    while (*recp && *recp != 0)
-        ret = ret * 16777619U ^ *recp++;
+    return hxkit_hash(recp, udata, uleng);
+}
 
-    // For keys < 5bytes, scrambling the bits is reqd:
-    ret += ret << 13;
-    ret ^= ret >> 7;
-    ret += ret << 3;
-    ret ^= ret >> 17;
-    ret += ret << 5;
-    return ret;
+HXHASH64
+hash64(char const *recp, char const *udata, int uleng)
+{
+    return hxkit_hash64(recp, udata, uleng);
 }
 
 int
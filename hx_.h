@@ -26,6 +26,7 @@
 
 int     diff(char const *, char const *, char const *, int);
 HXHASH  hash(char const *, char const *, int);
+HXHASH64 hash64(char const *, char const *, int);
 int     load(char *, int recsize, char const *, char const *, int);
 int     save(char const *, int reclen, char *, int bufsize, char const *, int);
 int     test(char const *, int reclen, char const *, int);
@@ -0,0 +1,175 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// hxbin: built-in binary record types, bound by hxlib without
+//  a library search. The udata type string is:
+//  "bin<N>"    key is the first N (1..999) bytes of the record.
+//  "binv"      key is a length byte (n) plus the n bytes after it.
+//  The rest of the record is the value.
+//  Keys hash 8 bytes at a time with a 64x64->128 multiply, and
+//  compare with memcmp. The hash is the same on every platform.
+//  Text form (load/save) is "hexkey\thexvalue".
+
+#include <ctype.h>
+#include <endian.h>
+
+#include "_hx.h"
+
+static int _bindiff(char const *, char const *, char const *, int);
+static HXHASH _binhash(char const *, char const *, int);
+static HXHASH64 _binhash64(char const *, char const *, int);
+static int _binload(char *, int, char const *, char const *, int);
+static int _binsave(char const *, int, char *, int, char const *, int);
+static int _bintest(char const *, int, char const *, int);
+
+// _binkeylen: key length of (recp) for the type in udata.
+static inline int
+_binkeylen(char const *recp, char const *udata)
+{
+    char const *cp = udata + 3;
+    int     n = 0;
+
+    if (*cp == 'v')
+        return 1 + (BYTE) * recp;
+    while (*cp)
+        n = n * 10 + *cp++ - '0';
+    return n;
+}
+
+static inline uint64_t
+_binmix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t) a *b;
+
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline int
+_hexval(int c)
+{
+    return isdigit(c) ? c - '0' : isxdigit(c) ? (c | 0x20) - 'a' + 10 : -1;
+}
+
+//--------------|---------------------------------------------
+// _hxbinbind: bind a built-in type, if (type) names one.
+int
+_hxbinbind(HXFILE * hp, char const *type)
+{
+    char const *cp = type + 3;
+
+    if (strncmp(type, "bin", 3))
+        return 0;
+    if (strcmp(cp, "v")) {
+        if (*cp < '1' || *cp > '9' || strspn(cp, "0123456789") != strlen(cp)
+            || strlen(cp) > 3)
+            return 0;
+    }
+
+    hxbind(hp, _bindiff, _binhash, _binload, _binsave, _bintest);
+    hxbind64(hp, _binhash64);
+    return 1;
+}
+
+static int
+_bindiff(char const *ap, char const *bp, char const *udata, int uleng)
+{
+    (void)uleng;
+    // For "binv", the length bytes are compared first.
+    return (udata[3] == 'v' && *ap != *bp)
+        || memcmp(ap, bp, _binkeylen(ap, udata));
+}
+
+static HXHASH
+_binhash(char const *recp, char const *udata, int uleng)
+{
+    HXHASH64 h = _binhash64(recp, udata, uleng);
+
+    return (HXHASH) (h ^ h >> 32);
+}
+
+static HXHASH64
+_binhash64(char const *recp, char const *udata, int uleng)
+{
+    (void)uleng;
+    int     len = _binkeylen(recp, udata);
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len, w;
+
+    for (; len >= 8; recp += 8, len -= 8) {
+        memcpy(&w, recp, 8);
+        h = _binmix(h ^ le64toh(w), 0xA0761D6478BD642FULL);
+    }
+    if (len) {
+        w = 0;
+        memcpy(&w, recp, len);
+        h = _binmix(h ^ le64toh(w), 0xA0761D6478BD642FULL);
+    }
+
+    return _binmix(h, 0xE7037ED1A0B428DBULL);
+}
+
+// _binload: (buf) is "hexkey\thexvalue"; the tab is optional.
+static int
+_binload(char *recp, int recsize, char const *buf, char const *udata,
+         int uleng)
+{
+    int     len = 0, hi, lo;
+
+    for (; *buf; ++len, buf += 2) {
+        if (*buf == '\t' && !*++buf)
+            break;
+        if ((hi = _hexval(buf[0])) < 0 || (lo = _hexval(buf[1])) < 0)
+            return 0;
+        if (len < recsize)
+            recp[len] = hi << 4 | lo;
+    }
+
+    return len > recsize || _bintest(recp, len, udata, uleng) ? len : 0;
+}
+
+static int
+_binsave(char const *recp, int reclen, char *buf, int bufsize,
+         char const *udata, int uleng)
+{
+    (void)uleng;
+    static char const hex[] = "0123456789abcdef";
+    int     keylen = _binkeylen(recp, udata);
+    int     i;
+    char   *cp = buf, *ep = buf + bufsize - 1;
+
+    // Format straight into buf; a blob can be far bigger than the stack.
+    for (i = 0; i <= reclen && cp < ep; ++i) {
+        if (i == keylen)
+            *cp++ = '\t';
+        if (i < reclen && cp < ep)
+            *cp++ = hex[(BYTE) recp[i] >> 4];
+        if (i < reclen && cp < ep)
+            *cp++ = hex[(BYTE) recp[i] & 15];
+    }
+    if (bufsize > 0)
+        *cp = 0;
+
+    return 2 * reclen + 2;
+}
+
+static int
+_bintest(char const *recp, int reclen, char const *udata, int uleng)
+{
+    (void)uleng;
+    return reclen > 0 && reclen >= _binkeylen(recp, udata);
+}
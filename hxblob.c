@@ -0,0 +1,167 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// hxblob: records longer than hxmaxrec, in version 2.3 files.
+//  A blob record is a stub in its chain (see REC_BLOB in _hx.h),
+//  plus a list of blob pages. Blob pages are overflow pages,
+//  allocated and freed through the bitmap like any other, but
+//  they hold BYTEs, not records: (recs) is 0. No chain links to
+//  them, so hxput never moves or shares them; hxshape moves one
+//  only to truncate the file, relinking the page or stub before it.
+//  Blob pages are written before the stub that points to them,
+//  and freed after it is gone, so a reader holding the stub's
+//  head lock needs no lock on them.
+
+#include <assert.h>
+
+#include "_hx.h"
+
+static PAGENO _blobput(HXLOCAL *, HXBUF *, char const *, int);
+
+//--------------|---------------------------------------------
+// _hxblobstub: write the blob pages for record (recp,leng),
+//  and return its stub, of user length BLOB_KEEP+sizeof(BLOBREF).
+//  The caller must hold the whole file: blob pages are found
+//  before its chain is locked.
+char *
+_hxblobstub(HXLOCAL * locp, char const *recp, int leng)
+{
+    HXFILE *hp = locp->file;
+    unsigned keep = BLOB_KEEP(hp);
+    char   *stub;
+
+    assert(leng > hxmaxrec(hp));
+    free(locp->membase);
+    locp->membase = locp->mem = calloc(1, sizeof(HXREC) + keep
+                                       + sizeof(BLOBREF) + HASH_TAIL(hp));
+    stub = locp->mem;
+    memcpy(stub, recp, keep);
+
+    // The key must lie in the part of the record kept in the stub.
+    STLG(0, stub + keep);
+    STLG(leng, stub + keep + sizeof(PAGENO));
+    if (_hxhash(hp, stub) != locp->hash || KIT_DIFF(hp, stub, recp))
+        LEAVE(locp, HXERR_BAD_RECORD);
+
+    STLG(_blobput(locp, &locp->buf[2], recp + keep, leng - keep),
+         stub + keep);
+    DEBUG2("leng=%d first=%u", leng, LDUL(stub + keep));
+    return stub;
+}
+
+// _blobput: write (recp,leng) to a list of blob pages. Pages
+//  are written last-first, so that each page's (next) is known.
+//  Returns the first pgno.
+static PAGENO
+_blobput(HXLOCAL * locp, HXBUF * bufp, char const *recp, int leng)
+{
+    HXFILE *hp = locp->file;
+    int     size = BLOB_DATA(hp);
+    int     pos = (leng - 1) / size * size;
+    PAGENO  next = 0, junk;
+
+    for (; pos >= 0; pos -= size) {
+        if (!_hxgetfreed(locp, bufp) && !_hxfindfree(locp, bufp)) {
+            junk = locp->head;
+            _hxlock(locp, locp->npages, 0);
+            _hxgrow(locp, bufp, 0, &junk);
+        }
+
+        bufp->used = IMIN(size, leng - pos);
+        memcpy(bufp->data, recp + pos, bufp->used);
+        LINK(bufp, next);
+        SPOT(bufp);
+        next = bufp->pgno;
+        _hxsave(locp, bufp);
+    }
+
+    return next;
+}
+
+// _hxblobget: copy the record that stub (recp) stands for into
+//  (buf), up to (size) BYTEs. Returns the record's length.
+//  Blob pages are read directly, not through a HXBUF.
+int
+_hxblobget(HXLOCAL * locp, char const *recp, char *buf, int size)
+{
+    HXFILE *hp = locp->file;
+    BLOBREF ref = BLOB_REF(hp, recp);
+    unsigned keep = BLOB_KEEP(hp), want, pos;
+    PAGENO  pg = ref.first;
+    int     loops = ref.leng / BLOB_DATA(hp) + 2;
+
+    if (ref.leng <= keep)
+        LEAVE(locp, HXERR_BAD_FILE);
+    memcpy(buf, RECDATA(recp), IMIN(keep, size));
+
+    for (pos = keep; pos < ref.leng && (int)pos < size; pos += want) {
+        off_t   at = (off_t) pg * hp->pgsize + sizeof(HXPAGE);
+        PGINFO  info;
+
+        want = IMIN(BLOB_DATA(hp), ref.leng - pos);
+        if (!--loops || pg >= locp->npages || IS_HEAD(hp, pg)
+            || IS_MAP(hp, pg))
+            LEAVE(locp, HXERR_BAD_FILE);
+
+        info = _hxpginfo(locp, pg);
+        if (info.recs || info.used != want
+            || !info.pgno != (pos + want == ref.leng))
+            LEAVE(locp, HXERR_BAD_FILE);
+
+        if (hp->mmap)
+            memcpy(buf + pos, &hp->mmap[at], IMIN(want, size - pos));
+        else
+            _hxread(locp, at, buf + pos, IMIN(want, size - pos));
+        pg = info.pgno;
+    }
+
+    return ref.leng;
+}
+
+// _hxblobfree: free the blob pages of (ref), once its stub is
+//  gone. (bufp) is clean on return.
+void
+_hxblobfree(HXLOCAL * locp, HXBUF * bufp, BLOBREF ref)
+{
+    HXFILE *hp = locp->file;
+    unsigned rest = ref.leng - BLOB_KEEP(hp), want;
+    PAGENO  pg = ref.first;
+    int     loops = ref.leng / BLOB_DATA(hp) + 2;
+
+    DEBUG2("first=%u leng=%u", ref.first, ref.leng);
+    for (; pg; rest -= want) {
+        PGINFO  info;
+
+        want = IMIN(BLOB_DATA(hp), rest);
+        if (!--loops || !rest || pg >= locp->npages || IS_HEAD(hp, pg)
+            || IS_MAP(hp, pg))
+            LEAVE(locp, HXERR_BAD_FILE);
+
+        info = _hxpginfo(locp, pg);
+        if (info.recs || info.used != want)
+            LEAVE(locp, HXERR_BAD_FILE);
+
+        _hxalloc(locp, pg, 0);
+        _hxfresh(locp, bufp, pg);
+        _hxsave(locp, bufp);
+        pg = info.pgno;
+    }
+}
+
+//EOF
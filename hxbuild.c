@@ -18,6 +18,8 @@
 //  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
 //-------------------------------------------------------------------------------
 // hxbuild: populate an empty file with a stream of records.
+// hxreserve: resize a file for an expected number of records,
+//  growing it in place with hxbuild's sizing.
 
 #include <assert.h>
 #include <stdint.h>             // uintptr_t
@@ -35,26 +37,34 @@ typedef struct {
     int     nrecs;
 } PART;
 
-static void _flush(HXLOCAL *, int vbufsize, int i, off_t nbytes);
+static PAGENO _fitsize(HXFILE const *, double nbytes, double nrecs);
+static char *_getline(HXLOCAL *, char *, int size, FILE *);
+static int _inpeof(HXLOCAL const *, FILE *);
+static void _mapinp(HXLOCAL *, FILE *, off_t size);
+static void _newmaps(HXLOCAL *, PAGENO);
+static void _ovfl(HXLOCAL *, HXREC const *, int size);
 static void _parse(HXLOCAL *, char *, int leng, HXREC *, int size);
-static void _split(HXLOCAL *, PART *, int nparts, int fd, FILE *);
+static void _putmaps(HXLOCAL *, PAGENO ovfl);
+static void _reput(HXLOCAL *, HXREC const *);
+static void _reputs(HXLOCAL *);
+static void _sortrecs(HXLOCAL *, REC * recv, REC const *tmpv, int nrecs);
+static void _split(HXLOCAL *, PART *, int nparts, int fd, FILE *, int memlen);
 static void _store(HXLOCAL *, char *, int nrecs, PAGENO *);
 
-// Sort records by head (for placement in chains) and by
-//  hash (to detect duplicate keys).
+// Order records within one head by hash (to detect duplicate keys).
 static int
-cmprec(REC const *a, REC const *b)
+cmphash(REC const *a, REC const *b)
 {
-    int     cmp = (int)a->head - (int)b->head;
+    HXHASH  x = RECHASH(a->recp), y = RECHASH(b->recp);
 
-    return cmp ? cmp : (int)RECHASH(a->recp) - (int)RECHASH(b->recp);
+    return x < y ? -1 : x > y;
 }
 
 static int
 recdiff(HXFILE * hp, HXREC * a, HXREC * b)
 {
     return RECHASH(a) != RECHASH(b)
-        || hx_diff(hp, RECDATA(a), RECDATA(b));
+        || KIT_DIFF(hp, RECDATA(a), RECDATA(b));
 }
 
 #define  TICK(x) double x = tick()
@@ -70,7 +80,8 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
     HXLOCAL loc, *locp = &loc;
     int     i;
     int     nrecs = 0;          // recs parsed from inpf
-    double  nbytes = 0;         // bytes written to fp[0]
+    double  nbytes = 0;         // bytes parsed (fp[0] + mem[])
+    double  spilled = 0;        // bytes written to fp[0]
     double  inpseen = 0;        // bytes read from inpf
     int     memlen = 0;         // bytes in mem[]
 
@@ -85,19 +96,24 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
     // Make copies of args, else gcc whinges about longjmp.
     FILE   *inpf = inp;
     double  inpsize = size;
-    HXBUF  *bufp = &locp->buf[0];
     struct stat sb;
 
-    if (!inpsize && !fstat(fileno(inpf), &sb))
-        inpsize = sb.st_size;
+    // A regular file is mmap'd, and read without stdio.
+    if (!fstat(fileno(inpf), &sb)) {
+        if (S_ISREG(sb.st_mode))
+            _mapinp(locp, inpf, sb.st_size);
+        if (!inpsize)
+            inpsize = sb.st_size - locp->inppos;
+    }
 
-    // Read inpfile, transform recs, write fp[0]
+    // Read inpfile, transform recs into mem[].
 
     // fp[0]: HXRECs that overflow the load into mem[].
-    //        If the input is a stream (not a file), and no size
-    //        is given, fp[0] gets the entire input.
+    //        Only used if the input is a stream (not a file),
+    //        and no size is given; fp[0] gets the entire input.
     // fp[1]: HXRECs that overflow _split or _store.
     //        They must be added with hxput, after bulk insert.
+    //        The first (ovfmax) bytes of them are kept in ovfv[].
 
     char    vb[2][STD_BUFSIZE] ALIGNED(DISK_PGSIZE);
 
@@ -107,11 +123,12 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
     locp->memsize = memlimit;
     locp->membase = locp->mem = malloc(memlimit + DISK_PGSIZE);
     locp->mem += (DISK_PGSIZE - 1) & -(uintptr_t) locp->mem;
+    locp->ovfmax = memlimit / 4;
 
     char    inpbuf[maxinp];
 
     TICK(t0);
-    while (fgets(inpbuf, maxinp, inpf)) {
+    while (_getline(locp, inpbuf, maxinp, inpf)) {
         HXREC  *rp = (HXREC *) (locp->mem + memlen);
         int     len = strlen(inpbuf);
 
@@ -128,7 +145,7 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
 
         len = memlen & -DISK_PGSIZE;
         memlen &= DISK_PGSIZE - 1;
-        nbytes += len;
+        spilled += len;
         if (!fwrite(locp->mem, len, 1, locp->fp[0]))
             LEAVE(locp, HXERR_WRITE);
 
@@ -140,15 +157,20 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
     if (!inpseen)               // Empty input
         LEAVE(locp, HXOKAY);
 
-    if (!fwrite(locp->mem, memlen, 1, locp->fp[0]))
-        LEAVE(locp, HXERR_WRITE);
-    nbytes += memlen;
+    // Once fp[0] holds a partial record, the rest of mem[] must follow it.
+    //  Otherwise, _split partitions mem[] without copying it.
+    nbytes = spilled + memlen;
+    if (spilled) {
+        if (!fwrite(locp->mem, memlen, 1, locp->fp[0]))
+            LEAVE(locp, HXERR_WRITE);
+        memlen = 0;
+    }
 
     DEBUG("analyze:%.3fs nrecs:%d nbytes:%.0f inpsize:%.0f",
           tick() - t0, nrecs, nbytes, inpsize);
 
     // Extrapolate nbytes and nrecs
-    if (!feof(inpf)) {
+    if (!_inpeof(locp, inpf)) {
         nbytes *= inpsize / inpseen;
         nrecs *= inpsize / inpseen;
     }
@@ -159,22 +181,14 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
         _hxresize(locp, 2);
         LEAVE(locp, HXOKAY);    // Empty input
     }
-    // (nbytes) includes HXREC overhead (6 bytes per rec).
-    // The average space wasted per page is half a record.
-    // Hash index takes (9*nrecs+7)/8 COUNT fields.
     // Resize the hxfile for all input to fit in head pages.
-
-    _hxresize(locp,
-              1 +
-              _hxd2f((nbytes + MIN_INDEX_BYTES(nrecs)) / (DATASIZE(hp) -
-                                                          nbytes / nrecs /
-                                                          2)));
+    _hxresize(locp, _fitsize(hp, nbytes, nrecs));
     locp->head = 0;             // disable rec_hash test in _hxcheckbuf.
-    PAGENO  ovfl = HXPGRATE;
+    PAGENO  ovfl = hp->pgrate;
 
-    if (feof(inpf) && nbytes <= memlen) {
+    if (_inpeof(locp, inpf) && !spilled) {
 
-        locp->recv = malloc((nrecs + 1) * sizeof(REC));
+        locp->recv = malloc((2 * nrecs + 1) * sizeof(REC));
         _store(locp, locp->mem, nrecs, &ovfl);
 
     } else {
@@ -184,7 +198,7 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
         PART    partv[nparts];
 
         TICK(t2);
-        _split(locp, partv, nparts, fd, inpf);
+        _split(locp, partv, nparts, fd, inpf, memlen);
         TICK(t3);
 
         free(locp->membase);
@@ -193,129 +207,172 @@ hxbuild(HXFILE * hp, FILE * inp, int memlimit, double size)
         for (i = nrecs = 0; i < nparts; ++i)
             if (nrecs < partv[i].nrecs)
                 nrecs = partv[i].nrecs;
-        locp->recv = malloc((nrecs + 1) * sizeof(REC));
+        locp->recv = malloc((2 * nrecs + 1) * sizeof(REC));
 
+        // Partitions are stored straight from the mapping _split filled.
         for (i = 0; i < nparts; ++i) {
-            locp->mapsize = partv[i].nbytes;
-            locp->tmpmap = mmap(NULL, locp->memsize, PROT_READ,
-                                MAP_PRIVATE + MAP_NOCORE, fd,
-                                i * locp->memsize);
-            if (locp->tmpmap == MAP_FAILED)
-                LEAVE(locp, HXERR_MMAP);
-
-            _store(locp, locp->tmpmap, partv[i].nrecs, &ovfl);
+            _store(locp, locp->tmpmap + (off_t) i * locp->memsize,
+                   partv[i].nrecs, &ovfl);
             DEBUG2("%d: %lld %d", i, partv[i].nbytes, partv[i].nrecs);
-
-            munmap(locp->tmpmap, locp->mapsize);
-            locp->tmpmap = 0;
         }
 
         DEBUG("split=%.3fs store=%.3fs", tick() - t3, t3 - t2);
     }
 
-    // Populate bitmap
+    _putmaps(locp, ovfl);
+    _reputs(locp);
 
-    ovfl -= HXPGRATE;
-    if (ovfl && IS_MAP(hp, ovfl))
-        ovfl -= HXPGRATE;
-    int     bitpos;
-    PAGENO  lastmap = _hxmap(hp, ovfl, &bitpos);
+    LEAVE(locp, locp->ret);
+}
 
-    _hxload(locp, bufp, 0);
+//--------------|---------------------------------------------
+HXRET
+hxreserve(HXFILE * hp, double nrecs, int avg_reclen)
+{
+    HXLOCAL loc, *locp = &loc;
+    PAGENO  pg, npages, before;
+    double  nbytes, oldbytes = 0, nold = 0;
 
-    // Write completely-filled bitmap pages before the last having any set.
-    memset(bufp->data + bufp->used, -1, DATASIZE(hp) - bufp->used);
-    for (bufp->pgno = 0; bufp->pgno < lastmap;
-         bufp->pgno = NEXT_MAP(hp, bufp->pgno)) {
-        STAIN(bufp);
-        _hxsave(locp, bufp);
+    if (!hp || nrecs < 0 || avg_reclen < 1 || avg_reclen > hxmaxrec(hp)
+        || !(hp->mode & HX_UPDATE) || SCANNING(hp) || hp->hold)
+        return HXERR_BAD_REQUEST;
 
-        if (!bufp->pgno) {      // fixup after writing bufp as ROOT page.
-            memset(bufp->data, -1, bufp->used);
-            bufp->next = bufp->used = bufp->recs = bufp->orig = 0;
-        }
-    }
+    ENTER(locp, hp, NULL, 3);
+    HXBUF  *bufp = &locp->buf[1];
+
+    _hxlock(locp, 0, 0);
+    _hxsize(locp);
+    if (IS_MMAP(hp))
+        _hxremap(locp);
+
+    // Size what is already there from the page headers.
+    for (pg = 1; pg < locp->npages; ++pg) {
+        if (IS_MAP(hp, pg))
+            continue;
 
-    // Write the last page having any bits set.
-    int     len = bufp->used + bitpos / 8;
+        PGINFO  x = _hxpginfo(locp, pg);
 
-    if (len < (int)DATASIZE(hp)) {
-        bufp->data[len] = ~(-2 << (bitpos & 7));
-        memset(bufp->data + len + 1, 0, DATASIZE(hp) - len - 1);
+        if (!x.recs)
+            continue;           // empty, or a blob page
+        oldbytes += x.used;
+        nold += x.recs;
     }
-    STAIN(bufp);
-    _hxsave(locp, bufp);
-
-    // Remaining map pages are all zero except their self-allocation bit.
-    bufp->next = bufp->used = bufp->recs = bufp->orig = 0;
-    memset(bufp->data, 0, DATASIZE(hp));
-    bufp->data[0] = 0x01;
-    while ((bufp->pgno = NEXT_MAP(hp, bufp->pgno)) < locp->npages) {
-        STAIN(bufp);
-        _hxsave(locp, bufp);
+
+    nbytes = nrecs * (sizeof(HXREC) + avg_reclen + HASH_TAIL(hp));
+    if (nrecs < nold)
+        nrecs = nold;
+    if (nbytes < oldbytes)
+        nbytes = oldbytes;
+
+    npages = nrecs ? _fitsize(hp, nbytes, nrecs) : 0;
+    DEBUG("nrecs=%.0f nbytes=%.0f npages=%u => %u",
+          nrecs, nbytes, locp->npages, npages);
+
+    // Resize once, write the new map pages once, then split each
+    //  new head from its SPLIT_LO chain, in _hxgrow order. Records
+    //  stay on disk throughout, but until the last split some are
+    //  in chains that lookups no longer search.
+    before = locp->npages;
+    if (npages > before) {
+        _hxresize(locp, npages);
+        for (pg = 0; pg < before; pg = NEXT_MAP(hp, pg)) {}
+        _newmaps(locp, pg);
+        _hxsplitall(locp, before);
     }
 
-    // HOLD_FILE keeps other hx calls from locking/unlocking the file.
-    HOLD_FILE(hp);
-    if (hxdebug) DEBUG("after bulk load, hxcheck=%s", hxmode(hxfix(hp, 0,0,0,0)));
+    _hxflushfreed(locp, bufp);
+    LEAVE(locp, locp->npages - before);
+}
 
-    // The hxfile is now consistent.
-    // Use hxput to add 'overflow' records written to fp[1].
-    // These may arise because of non-uniform partitioning,
-    // and when _store() cannot fit the record in the file
-    // using overflow pages already allocated.
-    // _store is not allowed to change the HXFILE size!
-    HXREC  *rp = (HXREC *) inpbuf;
-    HXRET   rc;
-    int     nputs = 0;
+// _fitsize: the file size (npages) in which (nrecs) records of
+//  (nbytes), including HXREC overhead, fit in head pages.
+//  The average space wasted per page is half a record.
+//  Hash index takes MIN_INDEX_BYTES per page of records.
+static PAGENO
+_fitsize(HXFILE const *hp, double nbytes, double nrecs)
+{
+    int     pgrecs = DATASIZE(hp) / (nbytes / nrecs) + 1;
+    double  ibytes = nrecs / pgrecs * MIN_INDEX_BYTES(hp, pgrecs);
 
-    rewind(locp->fp[1]);
+    return 1 + _hxd2f(hp, (nbytes + ibytes) / (DATASIZE(hp) -
+                                           nbytes / nrecs / 2));
+}
 
-    TICK(t4);
-    while (fread(rp, sizeof(HXREC), 1, locp->fp[1])) {
+// _getline: fgets, except that mmap'd input is copied
+//  directly from the mapping, with no read(2) calls.
+static char *
+_getline(HXLOCAL * locp, char *buf, int size, FILE * inpf)
+{
+    if (!locp->inpmap)
+        return fgets(buf, size, inpf);
 
-        if (!(len = RECLENG(rp)) ||
-            !fread((char *)(rp + 1), len, 1, locp->fp[1]))
-            LEAVE(locp, HXERR_READ);
-        if (0 > (rc = hxput(hp, RECDATA(rp), len)))
-            LEAVE(locp, rc);
-        if (hxdebug) {
-            int save = hxdebug; hxdebug = 2;
-            int chk = hxfix(hp,0,0,0,0);
-            hxdebug = save;
-            if (chk != HX_UPDATE)
-                break;
-        }
-        ++nputs;
-    }
-    DEBUG("hxputs: %d %.3fs", nputs, tick() - t4);
+    char const *cp = locp->inpmap + locp->inppos;
+    off_t   len = locp->inplen - locp->inppos;
 
-    if (!feof(locp->fp[1]))
-        LEAVE(locp, HXERR_READ);
+    if (!len)
+        return NULL;
+    if (len > size - 1)
+        len = size - 1;
 
-    LEAVE(locp, locp->ret);
+    char const *ep = memchr(cp, '\n', len);
+
+    if (ep)
+        len = ep + 1 - cp;
+    memcpy(buf, cp, len);
+    buf[len] = 0;
+
+    // Leave (inpf) where fgets would have left it.
+    if ((locp->inppos += len) == locp->inplen)
+        fseeko(inpf, 0, SEEK_END);
+
+    return buf;
+}
+
+static int
+_inpeof(HXLOCAL const *locp, FILE * inpf)
+{
+    return locp->inpmap ? locp->inppos == locp->inplen : feof(inpf);
 }
 
-// Flush a partition's vbuf to disk. Never called unless
-//  it is known that there is something to flush. If
-//  nbytes (total data length in partition (i), including
-//  vbuf) is a multiple of vbufsize, then the whole
-//  vbuf needs to be flushed.
+// _mapinp: mmap a regular input file, starting at its current
+//  stdio position. On failure, input falls back to stdio.
 static void
-_flush(HXLOCAL * locp, int vbufsize, int i, off_t nbytes)
+_mapinp(HXLOCAL * locp, FILE * inpf, off_t size)
 {
-    int     len = nbytes % vbufsize;
+    off_t   pos = ftello(inpf);
 
-    if (!len)
-        len = vbufsize;
+    if (pos < 0 || pos >= size)
+        return;
+
+    char   *mp = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_NOCORE,
+                      fileno(inpf), 0);
 
-    DEBUG2("part:%3d %3d len:%d %d", i, (int)(nbytes / vbufsize),
-           len, nbytes % vbufsize);
-    if (0 > lseek(fileno(locp->fp[2]), i * locp->memsize + nbytes - len, 0))
-        LEAVE(locp, HXERR_LSEEK);
+    if (mp == MAP_FAILED)
+        return;
+    madvise(mp, size, MADV_SEQUENTIAL);
 
-    if (0 > write(fileno(locp->fp[2]), locp->mem + i * vbufsize, len))
-        LEAVE(locp, HXERR_WRITE);
+    locp->inpmap = mp;
+    locp->inplen = size;
+    locp->inppos = pos;
+}
+
+// _ovfl: save a record to be added by hxput after bulk load.
+//  Records are kept in ovfv[] until it is full; after that,
+//  every record goes to fp[1], so that input order is kept.
+static void
+_ovfl(HXLOCAL * locp, HXREC const *rp, int len)
+{
+    if (!locp->ovfv && locp->ovfmax)
+        locp->ovfv = malloc(locp->ovfmax);
+
+    if (!locp->ovfv || locp->ovflen + len > locp->ovfmax) {
+        locp->ovfmax = 0;
+        if (!fwrite(rp, len, 1, locp->fp[1]))
+            LEAVE(locp, HXERR_WRITE);
+    } else {
+        memcpy(locp->ovfv + locp->ovflen, rp, len);
+        locp->ovflen += len;
+    }
 }
 
 static void
@@ -326,55 +383,242 @@ _parse(HXLOCAL * locp, char *inpbuf, int len, HXREC * rp, int recsize)
 
     inpbuf[len] = 0;
 
-    len = hx_load(locp->file, (char *)(rp + 1), recsize, inpbuf);
+    HXFILE *hp = locp->file;
+
+    len = hx_load(hp, (char *)(rp + 1), recsize, inpbuf);
 
-    if (len < 1 || len > recsize)
+    // hxbuild does not make blobs.
+    if (len < 1 || len > recsize || len > hxmaxrec(hp))
         LEAVE(locp, HXERR_BAD_RECORD);
 
-    STLG(hx_hash(locp->file, RECDATA(rp)), &rp->hash);
-    STSH(len, &rp->leng);
+    HXHASH64 hash = _hxhash(hp, RECDATA(rp));
+
+    STLG(hash, &rp->hash);
+    if (HASH_TAIL(hp))
+        STLG(hash >> 32, (char *)(rp + 1) + len);
+    STSH(len + HASH_TAIL(hp), &rp->leng);
 }
 
-// _split first reads back and partitions locp->fp[0],
-//  since that is almost certainly still in disk cache.
-//  It then reads, parses and partitions the rest of (inpf).
+// _putmaps: write every map page in one pass, after _store
+//  allocated overflow pages up to (ovfl).
 static void
-_split(HXLOCAL * locp, PART * partv, int nparts, int fd, FILE * inpf)
+_putmaps(HXLOCAL * locp, PAGENO ovfl)
 {
     HXFILE *hp = locp->file;
-    int     middle = _hxd2f((locp->mask + 1) >> 1);
-    int     split = SPLIT_PAGE(locp);
-    int     i, len, d0 = 1;
+    HXBUF  *bufp = &locp->buf[0];
+
+    ovfl -= hp->pgrate;
+    if (ovfl && IS_MAP(hp, ovfl))
+        ovfl -= hp->pgrate;
+    int     bitpos;
+    PAGENO  pg, lastmap = _hxmap(hp, ovfl, &bitpos);
+
+    // Fill bitmap pages up to the last having any bits set. Each page
+    //  is placed with _hxfresh, so this also works for mmap files.
+    for (pg = 0; pg <= lastmap; pg = NEXT_MAP(hp, pg)) {
+        if (pg) {
+            _hxfresh(locp, bufp, pg);
+        } else {
+            // The root's (next,used,recs) hold its HXROOT header.
+            _hxload(locp, bufp, 0);
+            memset(bufp->data + bufp->used, 0, DATASIZE(hp) - bufp->used);
+        }
+
+        if (pg < lastmap) {
+            memset(bufp->data + bufp->used, -1, DATASIZE(hp) - bufp->used);
+        } else {
+            // In the root page, (bitpos) already counts the udata[] bytes.
+            int     len = bitpos / 8;
+
+            memset(bufp->data + bufp->used, -1, len - bufp->used);
+            if (len < (int)DATASIZE(hp))
+                bufp->data[len] = ~(-2 << (bitpos & 7));
+        }
+        STAIN(bufp);
+        _hxsave(locp, bufp);
+    }
+
+    _newmaps(locp, pg);
+}
+
+// _newmaps: write the map pages from (pg) on, for pages that
+//  are all free: zero except their self-allocation bit.
+static void
+_newmaps(HXLOCAL * locp, PAGENO pg)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *bufp = &locp->buf[0];
+
+    for (; pg < locp->npages; pg = NEXT_MAP(hp, pg)) {
+        _hxfresh(locp, bufp, pg);
+        bufp->data[0] = 0x01;
+        STAIN(bufp);
+        _hxsave(locp, bufp);
+    }
+}
+
+static void
+_reput(HXLOCAL * locp, HXREC const *rp)
+{
+    HXFILE *hp = locp->file;
+    HXRET   rc = hxput(hp, RECDATA(rp), USERLENG(hp, rp));
+
+    if (rc < 0)
+        LEAVE(locp, rc);
 
-    //vbufsize: must divide memsize evenly,
-    //                and be a multiple of DISK_PGSIZE.
-    int     vbufsize = locp->memsize / DISK_PGSIZE / nparts * DISK_PGSIZE;
+    if (hxdebug) {
+        int save = hxdebug; hxdebug = 2;
+        int chk = hxfix(hp,0,0,0,0);
+        hxdebug = save;
+        if (chk != HX_UPDATE)
+            LEAVE(locp, HXERR_BAD_FILE);
+    }
+}
 
-    if (vbufsize < hxmaxrec(hp))    // memsize too small for inp
-        LEAVE(locp, HXERR_BAD_REQUEST);
+// _reputs: hxput the records that _store could not place.
+//  The hxfile is now consistent. Records saved by _ovfl may
+//  arise because of non-uniform partitioning, and when _store()
+//  cannot fit the record in the file using overflow pages
+//  already allocated. _store is not allowed to change the HXFILE size!
+static void
+_reputs(HXLOCAL * locp)
+{
+    HXFILE *hp = locp->file;
+    char    recbuf[2 * DATASIZE(hp)];
+    HXREC  *rp = (HXREC *) recbuf;
+    char   *cp, *ep = locp->ovfv + locp->ovflen;
+    int     len, nputs = 0;
 
-    DEBUG("parts:%d split:%d middle:%d vbuf:%dK",
-          nparts, split, middle, vbufsize / 1024);
+    // HOLD_FILE keeps other hx calls from locking/unlocking the file.
+    HOLD_FILE(hp);
+    if (hxdebug) DEBUG("after bulk load, hxcheck=%s", hxmode(hxfix(hp, 0,0,0,0)));
+
+    TICK(t4);
+    for (cp = locp->ovfv; cp < ep; cp += RECSIZE(cp), ++nputs)
+        _reput(locp, (HXREC *) cp);
+
+    if (locp->fp[1]) {
+        rewind(locp->fp[1]);
+        while (fread(rp, sizeof(HXREC), 1, locp->fp[1])) {
+
+            if (!(len = RECLENG(rp)) ||
+                !fread((char *)(rp + 1), len, 1, locp->fp[1]))
+                LEAVE(locp, HXERR_READ);
+            _reput(locp, rp);
+            ++nputs;
+        }
+
+        if (!feof(locp->fp[1]))
+            LEAVE(locp, HXERR_READ);
+    }
+    DEBUG("hxputs: %d %.3fs", nputs, tick() - t4);
+}
+
+// _sortrecs: counting sort of tmpv[] into recv[] by head (for placement
+//  in chains), then order each head's records by hash, so that
+//  duplicate keys are adjacent. Heads of one partition are a narrow
+//  range of data pages; most heads have only a few records.
+static void
+_sortrecs(HXLOCAL * locp, REC * recv, REC const *tmpv, int nrecs)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  lo = locp->dpages, hi = 0;
+    int     i, j;
+
+    for (i = 0; i < nrecs; ++i) {
+        PAGENO  pg = _hxf2d(hp, tmpv[i].head);
+
+        if (lo > pg)
+            lo = pg;
+        if (hi < pg)
+            hi = pg;
+    }
+
+    if (lo > hi)
+        return;
+
+    int     nheads = hi - lo + 1, *posv = calloc(nheads + 1, sizeof(int));
+
+    for (i = 0; i < nrecs; ++i)
+        ++posv[_hxf2d(hp, tmpv[i].head) - lo + 1];
+    for (i = 1; i < nheads; ++i)
+        posv[i] += posv[i - 1];
+    for (i = 0; i < nrecs; ++i)
+        recv[posv[_hxf2d(hp, tmpv[i].head) - lo]++] = tmpv[i];
+    free(posv);
+
+    for (i = 0; i < nrecs; i = j) {
+        for (j = i + 1; j < nrecs && recv[j].head == recv[i].head; ++j) {
+        }
+
+        if (j - i > 32) {
+            qsort(recv + i, j - i, sizeof *recv, (cmpfn_t) cmphash);
+            continue;
+        }
+
+        int     k, m;
+
+        for (k = i + 1; k < j; ++k) {
+            REC     r = recv[k];
+            HXHASH  h = RECHASH(r.recp);
+
+            for (m = k; m > i && RECHASH(recv[m - 1].recp) > h; --m)
+                recv[m] = recv[m - 1];
+            recv[m] = r;
+        }
+    }
+}
+
+// _split partitions the records still in mem[] (memlen bytes),
+//  then reads back locp->fp[0], since that is almost certainly
+//  still in disk cache. It then reads, parses and partitions
+//  the rest of (inpf). Partitions are copied straight into an
+//  mmap of the partition file (fd); _store reads them from there.
+static void
+_split(HXLOCAL * locp, PART * partv, int nparts, int fd, FILE * inpf,
+       int memlen)
+{
+    HXFILE *hp = locp->file;
+    int     middle = _hxd2f(hp, (locp->mask + 1) >> 1);
+    int     split = SPLIT_PAGE(locp);
+    int     i, len, d0 = 1;
+    char   *memp = locp->mem, *endp = memp + memlen;
+
+    DEBUG("parts:%d split:%d middle:%d mem:%d",
+          nparts, split, middle, memlen);
 
     memset(partv, 0, sizeof(PART) * nparts);
 
-    if (ftruncate(fd, nparts * locp->memsize))
+    locp->mapsize = (off_t) nparts * locp->memsize;
+    if (ftruncate(fd, locp->mapsize))
         LEAVE(locp, HXERR_FTRUNCATE);
 
+    locp->tmpmap = mmap(NULL, locp->mapsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_NOCORE, fd, 0);
+    if (locp->tmpmap == MAP_FAILED) {
+        locp->tmpmap = 0;
+        LEAVE(locp, HXERR_MMAP);
+    }
     // Distribute records across partitions
 
     int const maxrec = DATASIZE(hp);
     char    recbuf[maxrec], inpbuf[maxrec * 3];
-    HXREC  *rp = (HXREC *) recbuf;
+    HXREC  *rp;
 
     rewind(locp->fp[0]);
     while (1) {
 
-        if (!(d0 &= fread(rp, sizeof *rp, 1, locp->fp[0])
-              && (len = RECLENG(rp))
-              && fread((char *)(rp + 1), len, 1, locp->fp[0]))) {
+        rp = (HXREC *) recbuf;
+        if (memp < endp) {
 
-            if (!fgets(inpbuf, maxrec * 2, inpf))
+            rp = (HXREC *) memp;
+            memp += RECSIZE(rp);
+
+        } else if (!(d0 &= fread(rp, sizeof *rp, 1, locp->fp[0])
+                     && (len = RECLENG(rp))
+                     && fread((char *)(rp + 1), len, 1, locp->fp[0]))) {
+
+            if (!_getline(locp, inpbuf, sizeof inpbuf, inpf))
                 break;
 
             _parse(locp, inpbuf, strlen(inpbuf), rp, maxrec);
@@ -382,7 +626,7 @@ _split(HXLOCAL * locp, PART * partv, int nparts, int fd, FILE * inpf)
         // Linear hash does not distribute equally: buckets in
         // the range [split..middle-1] get 2x as many records
         // as the rest. (i) is jinked to account for this.
-        int     pg = _hxhead(locp, RECHASH(rp));
+        int     pg = _hxhead(locp, RECHASH64(hp, rp));
 
         i = (pg < split ? pg
              : pg < middle ? pg + pg - split : pg + middle - split)
@@ -390,26 +634,10 @@ _split(HXLOCAL * locp, PART * partv, int nparts, int fd, FILE * inpf)
 
         len = RECSIZE(rp);
         if (partv[i].nbytes + len > locp->memsize) {
-
-            if (!fwrite(rp, len, 1, locp->fp[1]))
-                LEAVE(locp, HXERR_WRITE);
-
+            _ovfl(locp, rp, len);
         } else {
-            char   *src = (char *)rp;
-            char   *vbuf = &locp->mem[i * vbufsize];
-            int     pos = partv[i].nbytes % vbufsize;
-            int     left = vbufsize - pos;
-
-            if (len >= left) {
-                memcpy(vbuf + pos, src, left);
-                partv[i].nbytes += left;
-                src += left;
-                len -= left;
-                _flush(locp, vbufsize, i, partv[i].nbytes);
-                pos = 0;
-            }
-
-            memcpy(vbuf + pos, src, len);
+            memcpy(locp->tmpmap + (off_t) i * locp->memsize
+                   + partv[i].nbytes, rp, len);
             partv[i].nbytes += len;
             partv[i].nrecs++;
         }
@@ -417,10 +645,6 @@ _split(HXLOCAL * locp, PART * partv, int nparts, int fd, FILE * inpf)
 
     if (!feof(locp->fp[0]))
         LEAVE(locp, HXERR_READ);
-
-    for (i = 0; i < nparts; ++i)
-        if (partv[i].nbytes % vbufsize)
-            _flush(locp, vbufsize, i, partv[i].nbytes);
 }
 
 static void
@@ -428,17 +652,19 @@ _store(HXLOCAL * locp, char *cp, int nrecs, PAGENO * povfl)
 {
     HXFILE *hp = locp->file;
     HXBUF  *bufp = &locp->buf[0];
-    REC    *recv = locp->recv;
+    REC    *recv = locp->recv, *tmpv = recv + nrecs + 1;
     int     i, j, orecs = 0, osize = 0;
 
     for (i = 0; i < nrecs; ++i, cp += RECSIZE(cp)) {
-        assert((int)RECLENG(cp) <= hxmaxrec(hp));
-        assert(hx_test(hp, RECDATA(cp), RECLENG(cp)));
-        recv[i].recp = (HXREC *) cp;
-        recv[i].head = _hxhead(locp, RECHASH(cp));
+        assert((int)USERLENG(hp, cp) <= hxmaxrec(hp));
+        assert(hx_test(hp, RECDATA(cp), USERLENG(hp, cp)));
+        tmpv[i].recp = (HXREC *) cp;
+        tmpv[i].head = _hxhead(locp, RECHASH64(hp, cp));
     }
 
-    qsort(recv, nrecs, sizeof *recv, (cmpfn_t) cmprec);
+    TICK(t0);
+    _sortrecs(locp, recv, tmpv, nrecs);
+    DEBUG("sort %d recs: %.3fs", nrecs, tick() - t0);
 
     recv[nrecs].head = 0;       // stopper for "for(j=i..." loop
 
@@ -478,19 +704,19 @@ _store(HXLOCAL * locp, char *cp, int nrecs, PAGENO * povfl)
                     LINK(bufp, *povfl);
                     _hxsave(locp, bufp);
                     _hxfresh(locp, bufp, bufp->next);
-                    *povfl += HXPGRATE;
+                    *povfl += hp->pgrate;
                     if (IS_MAP(hp, *povfl))
-                        *povfl += HXPGRATE;
+                        *povfl += hp->pgrate;
                 }
             }
 
             if (FITS(hp, bufp, size, 1)) {
                 _hxappend(bufp, (char *)recv[i].recp, size);
                 bufp->recs++;
-            } else if (!fwrite(recv[i].recp, size, 1, locp->fp[1]))
-                LEAVE(locp, HXERR_WRITE);
-            else
+            } else {
+                _ovfl(locp, recv[i].recp, size);
                 ++orecs, osize += size;
+            }
 
             bytes -= size;
         }
@@ -50,7 +50,13 @@ nosave(HXLOCAL * locp, HXBUF * bufp)
     SCRUB(bufp);
 }
 
+// vblob[] bits: a page that looks like a blob page, and one
+//  that a good stub's list of blob pages includes.
+enum { BLOB_PAGE = 1, BLOB_CLAIMED = 2 };
+
+static int check_stub(HXLOCAL *, char const *recp);
 static void clear_page(HXLOCAL * locp, HXBUF * bufp);
+static void free_blob(HXLOCAL *, HXBUF * mapp, HXBUF * bufp, PAGENO);
 static int xor_map(HXLOCAL *, HXBUF * mapp, PAGENO pg, int);
 static PAGENO pghash(PAGENO);
 
@@ -112,6 +118,13 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
         hxlib(hp, hp->udata, 0);
         badroot = 1;
     }
+    // Repair upgrades an older file format: every page then
+    //  fails the index check below, and is rewritten. A page
+    //  too full for the new hind[] has records moved elsewhere.
+    if (tmpfp && hp->version != HXVERSION) {
+        hp->version = HXVERSION;
+        badroot = 1;
+    }
     // Now that (pgsize,data,uleng) can be trusted...
     ENTER(locp, hp, 0, 2);
 
@@ -134,8 +147,9 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
         HXROOT *rp = (HXROOT *) mapp->page;
 
         _hxload(locp, mapp, 0);
-        STSH(hp->pgsize, &rp->pgsize);
+        STSH(hp->pgsize < HX_MAX_PGSIZE ? hp->pgsize : 0, &rp->pgsize);
         STSH(hp->version, &rp->version);
+        STSH(hp->flags, &rp->flags);
         mapp->next = LDUL(&mapp->page->next);
         mapp->used = hp->uleng;
         memcpy((char *)(rp + 1), hp->udata, hp->uleng);
@@ -146,10 +160,11 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
     }
 
     _hxinitRefs(locp);
-    locp->visit = calloc(locp->npages / HXPGRATE + 1, sizeof(PAGENO));
+    locp->visit = calloc(locp->npages / hp->pgrate + 1, sizeof(PAGENO));
+    locp->vblob = calloc(locp->npages / hp->pgrate + 1, sizeof(COUNT));
 
     lastmap = locp->npages - 1;
-    lastmap = _hxmap(hp, lastmap - lastmap % HXPGRATE, &lastbit);
+    lastmap = _hxmap(hp, lastmap - lastmap % hp->pgrate, &lastbit);
     for (pg = 0; pg < locp->npages; ++pg) {
 
         if (IS_MAP(hp, pg)) {
@@ -173,10 +188,10 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
     // then we skip the 'duplicate record' test: the loops
     // have not been fixed!
     for (ph = 1; ph < locp->npages; ++ph) {
-        if (IS_HEAD(ph)) {
+        if (IS_HEAD(hp, ph)) {
             hash = pghash(ph) | VISITED;
             for (pg = ph; (pn = locp->vnext[pg]); pg = pn) {
-                pp = locp->visit + pn / HXPGRATE;
+                pp = locp->visit + pn / hp->pgrate;
                 if (*pp & VISITED) {
                     BAD(bad_loop, pn);
                     PUTLINK(locp, pg, 0);
@@ -200,7 +215,7 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
     // be unlinked.
     for (pg = 1; pg < locp->npages; ++pg) {
         pn = locp->vnext[pg];
-        if (pn && locp->visit[pn / HXPGRATE] & ~VISITED) {
+        if (pn && locp->visit[pn / hp->pgrate] & ~VISITED) {
             BAD(bad_refs, pn);
             PUTLINK(locp, pg, 0);
         }
@@ -209,7 +224,7 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
     // Check for duplicate records in adjacent pages.
     if (!hxcheck_errv[bad_loop]) {
         for (ph = 1; ph < locp->npages; ++ph) {
-            if (locp->vnext[ph] && IS_HEAD(ph)) {
+            if (locp->vnext[ph] && IS_HEAD(hp, ph)) {
                 _hxload(locp, srcp, locp->vnext[ph]);
                 _hxload(locp, dstp, ph);
                 if (hxcheck_errv[bad_index])
@@ -220,8 +235,8 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
                 while (1) {
                     FOR_EACH_REC(recp, srcp, endp) {
                         if (0 <=
-                            _hxfind(locp, dstp, RECHASH(recp), RECDATA(recp),
-                                    0))
+                            _hxfind(locp, dstp, RECHASH64(hp, recp),
+                                    RECDATA(recp), 0))
                             break;
                     }
 
@@ -242,7 +257,8 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
     }
     // The bitmap is now correct. Dump records of
     //  unreferenced nonempty pages, then free those pages.
-    for (pg = 0; pg < locp->npages; pg += HXPGRATE) {
+    hp->freehint = 0;
+    for (pg = 0; pg < locp->npages; pg += hp->pgrate) {
 
         if (IS_MAP(hp, pg)) {
             if (mapp->pgno != pg) {
@@ -251,7 +267,10 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
             }
         } else if (!VREF(locp, pg) && xor_map(locp, mapp, pg, 0)) {
             BAD(bad_orphan, pg);
-            if (REPAIRING(locp)) {
+            if (locp->vblob[pg >> hp->pgshift] & BLOB_PAGE) {
+                if (REPAIRING(locp))
+                    free_blob(locp, mapp, bufp, pg);
+            } else if (REPAIRING(locp)) {
                 _cksave(locp, bufp);
                 _hxload(locp, bufp, pg);
                 if (1 != fwrite(bufp->data, bufp->used, 1, tmpfp))
@@ -288,21 +307,41 @@ hxfix(HXFILE * hp, FILE * tmpfp, int pgsize, char const *udata, int uleng)
     HOLD_FILE(hp);
     ret = HXOKAY;
     while (fread(recp, sizeof(HXREC), 1, tmpfp)) {
+        char   *datap = recp + sizeof(HXREC);
+
         leng = RECLENG(recp);
-        if (leng != (int)fread(recp, 1, leng, tmpfp)) {
+        if (leng != (int)fread(datap, 1, leng, tmpfp)) {
             ret = HXERR_READ;
             break;
         }
+        leng -= HASH_TAIL(hp);
+
+        // A dumped stub is put back as its whole record. Its old
+        //  blob pages were kept, since check_stub claimed them.
+        if (IS_BLOB(recp)) {
+            BLOBREF ref = BLOB_REF(hp, recp);
+
+            if (!(locp->vblob[ref.first >> hp->pgshift] & BLOB_CLAIMED))
+                continue;
+            if (locp->memsize < (int)ref.leng) {
+                free(locp->membase);
+                locp->membase = locp->mem =
+                    malloc(locp->memsize = ref.leng);
+            }
+            leng = _hxblobget(locp, recp, locp->mem, ref.leng);
+            _hxblobfree(locp, mapp, ref);
+            datap = locp->mem;
+        }
         // Catch (and skip) hx_test failures, rather than
         // have hxput call hx_test and return an error.
-        if (!hx_test(hp, recp, leng)) {
-            DEBUG("skip reinsert: %d: %.*s", ret, leng, recp);
+        if (!hx_test(hp, datap, leng)) {
+            DEBUG("skip reinsert: %d: %.*s", ret, leng, datap);
             continue;
         }
 
-        ret = hxget(hp, (char *)(uintptr_t) recp, 0);
+        ret = hxget(hp, (char *)(uintptr_t) datap, 0);
         if (!ret)
-            ret = hxput(hp, recp, leng);
+            ret = hxput(hp, datap, leng);
 
         if ((int)ret < 0)
             break;
@@ -318,17 +357,29 @@ check_data_page(HXLOCAL * locp, HXBUF * mapp, PAGENO pg,
                 int errv[], HXBUF * bufp, FILE * tmpfp)
 {
     HXFILE *hp = locp->file;
-    PAGENO  xorsum, hash, *pp;
+    PAGENO  xorsum, *pp;
     char   *recp, *endp;
 
 #   define BAD(x,p) (DEBUG2("pgno=%u %s",p,hxcheck_namev[x]), ++errv[x])
 
     _hxload(locp, bufp, pg);
-    if (bufp->next >= locp->npages || IS_HEAD(bufp->next)) {
+    if (bufp->next >= locp->npages || IS_HEAD(hp, bufp->next)) {
         BAD(bad_next, pg), LINK(bufp, 0);
     }
 
     _hxsetRef(locp, bufp->pgno, bufp->next);
+
+    // A blob page holds no records; check_stub checks its
+    //  (used,next), and the orphan pass frees it if no stub does.
+    if (HAS_BLOBS(hp) && IS_BLOBPG(hp, bufp)
+        && bufp->used <= BLOB_DATA(hp)) {
+        locp->vblob[pg >> hp->pgshift] |= BLOB_PAGE;
+        if (!xor_map(locp, mapp, pg, 0)) {
+            BAD(bad_free_bit, pg);
+            xor_map(locp, mapp, pg, 1);
+        }
+        return;
+    }
     if (bufp->used && (bufp->used < MINRECSIZE || bufp->used > DATASIZE(hp))) {
         BAD(bad_used, pg);
         clear_page(locp, bufp);
@@ -339,26 +390,36 @@ check_data_page(HXLOCAL * locp, HXBUF * mapp, PAGENO pg,
     // - RECHASH matches hash(rec)
     // - sum of RECSIZEs is (used)
     // - count of recs is (recs)
-    int     recs = 0;
+    // - a blob stub has good blob pages (else it is dropped)
+    int     recs = 0, nbad = 0;
+    COUNT   badv[MAX_RECS(hp)];
 
     FOR_EACH_REC(recp, bufp, endp) {
         unsigned size = RECSIZE(recp);
 
-        if (size < MINRECSIZE || size > (unsigned)(endp - recp)) {
+        if (size < MINRECSIZE + HASH_TAIL(hp)
+            || size > (unsigned)(endp - recp)
+            || (IS_BLOB(recp) && (!HAS_BLOBS(hp) || USERLENG(hp, recp)
+                                  != BLOB_KEEP(hp) + sizeof(BLOBREF)))) {
             BAD(bad_rec_size, pg);
             break;
         }
 
-        if (!hx_test(hp, RECDATA(recp), size - sizeof(HXREC))) {
+        if (!IS_BLOB(recp)
+            && !hx_test(hp, RECDATA(recp), USERLENG(hp, recp))) {
             BAD(bad_rec_test, pg);
             break;
         }
 
-        hash = hx_hash(hp, RECDATA(recp));
-        if (hash != (PAGENO) RECHASH(recp)) {
+        if (_hxhash(hp, RECDATA(recp)) != RECHASH64(hp, recp)) {
             BAD(bad_rec_hash, pg);
             break;
         }
+
+        if (IS_BLOB(recp) && !check_stub(locp, recp)) {
+            BAD(bad_blob, pg);
+            badv[nbad++] = recp - bufp->data;
+        }
         ++recs;
     }
 
@@ -374,15 +435,46 @@ check_data_page(HXLOCAL * locp, HXBUF * mapp, PAGENO pg,
         STAIN(bufp);
         recover(locp, bufp, tmpfp);
     }
+    // Drop bad stubs, last first so that (badv) stays valid.
+    while (nbad-- && REPAIRING(locp)) {
+        char   *cp = bufp->data + badv[nbad];
+        int     size = RECSIZE(cp);
+
+        memmove(cp, cp + size, bufp->data + bufp->used - cp - size);
+        bufp->used -= size;
+        --bufp->recs;
+        STAIN(bufp);
+    }
+    // Check that hind[] fits in what (used) leaves free. After
+    //  an upgrade, it may not: the version 2 hind[] can be larger.
+    //  Keep the records that fit; dump the rest for reinsertion.
+    if (!FITS(hp, bufp, 0, 0)) {
+        int     used = 0, nrecs = 0;
+
+        BAD(bad_used, pg);
+        FOR_EACH_REC(recp, bufp, endp) {
+            if (!_FITS(hp, used, nrecs, RECSIZE(recp), 1))
+                break;
+            used += RECSIZE(recp), ++nrecs;
+        }
+
+        if (REPAIRING(locp)
+            && 1 != fwrite(bufp->data + used, bufp->used - used, 1, tmpfp))
+            LEAVE(locp, HXERR_WRITE);
+
+        bufp->used = used;
+        bufp->recs = nrecs;
+        STAIN(bufp);
+    }
     // Check whether this page has multiple heads.
     //  For nonheads, store xor(heads).
     _hxfindHeads(locp, bufp);
-    if (!IS_HEAD(pg)) {
+    if (!IS_HEAD(hp, pg)) {
         for (xorsum = 0, pp = locp->vprev; *pp;) {
             xorsum ^= pghash(*pp++);
         }
 
-        locp->visit[pg / HXPGRATE] = xorsum & ~VISITED;
+        locp->visit[pg / hp->pgrate] = xorsum & ~VISITED;
 
     } else if (bufp->used && (locp->vprev[1] || pg != locp->vprev[0])) {
         BAD(bad_head_rec, pg);
@@ -397,21 +489,18 @@ check_data_page(HXLOCAL * locp, HXBUF * mapp, PAGENO pg,
         BAD(bad_free_next, pg);
         BUFLINK(locp, bufp, 0);
     }
-    // Check that bytes beyond [used] are correct.
-    int     hsize = HIND_SIZE(hp, bufp);
-    COUNT  *act = (COUNT *) (bufp->data + DATASIZE(hp)) - hsize;
-    COUNT   exp[hsize];
-
-    _hxindexify(locp, bufp, exp + hsize - 1);
-    if (memcmp(act, exp, hsize * sizeof(COUNT))) {
+    // Check that bytes beyond [used] are a correct index.
+    //  Incremental updates place entries differently from
+    //  _hxindexify, so this checks what hind[] maps, not its bytes.
+    if (!_hxindexed(locp, bufp)) {
         BAD(bad_index, pg);
         if (tmpfp) {
-            memcpy(act, exp, hsize * sizeof(COUNT));
+            _hxindexify(locp, bufp, NULL);
             STAIN(bufp);
         }
     }
     // Check whether page is correct in bitmap
-    if (!IS_HEAD(pg)
+    if (!IS_HEAD(hp, pg)
         && !bufp->used != !xor_map(locp, mapp, pg, 0)) {
         BAD(bufp->used ? bad_free_bit : bad_used_bit, pg);
         xor_map(locp, mapp, pg, 1);
@@ -463,6 +552,42 @@ check_map_page(HXLOCAL * locp, HXBUF * mapp, PAGENO pg,
 #    undef BAD                  // Search no more for errors
 }
 
+// check_stub: check that the blob pages of stub (recp) exist,
+//  hold the rest of its record, and belong to no other stub.
+//  If so, claim them, and count the stub as a ref to the first.
+static int
+check_stub(HXLOCAL * locp, char const *recp)
+{
+    HXFILE *hp = locp->file;
+    BLOBREF ref = BLOB_REF(hp, recp);
+    unsigned rest, want;
+    PAGENO  pg;
+    int     loops = ref.leng / BLOB_DATA(hp) + 2;
+
+    if (ref.leng <= (unsigned)hxmaxrec(hp))
+        return 0;
+
+    for (pg = ref.first, rest = ref.leng - BLOB_KEEP(hp); rest; rest -= want) {
+        PGINFO  info;
+
+        want = IMIN(BLOB_DATA(hp), rest);
+        if (!--loops || !pg || pg >= locp->npages || IS_HEAD(hp, pg)
+            || IS_MAP(hp, pg)
+            || locp->vblob[pg >> hp->pgshift] & BLOB_CLAIMED)
+            return 0;
+
+        info = _hxpginfo(locp, pg);
+        if (info.recs || info.used != want || !info.pgno != (rest == want))
+            return 0;
+        pg = info.pgno;
+    }
+
+    for (pg = ref.first; pg; pg = _hxpginfo(locp, pg).pgno)
+        locp->vblob[pg >> hp->pgshift] |= BLOB_CLAIMED;
+    ++VREF(locp, ref.first);
+    return 1;
+}
+
 static void
 clear_page(HXLOCAL * locp, HXBUF * bufp)
 {
@@ -472,6 +597,40 @@ clear_page(HXLOCAL * locp, HXBUF * bufp)
     BUFLINK(locp, bufp, 0);
 }
 
+// free_blob: free orphan blob page (pg), and the pages after it
+//  that only it refers to. The pass over pages in hxfix is at
+//  (pg), so (mapp) is restored to its map page.
+static void
+free_blob(HXLOCAL * locp, HXBUF * mapp, HXBUF * bufp, PAGENO pg)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  mpg = mapp->pgno, next;
+    int     bitpos;
+
+    do {
+        next = locp->vnext[pg];
+        _hxsave(locp, bufp);
+        _hxload(locp, bufp, pg);
+        clear_page(locp, bufp);
+        _hxsave(locp, bufp);
+        locp->vblob[pg >> hp->pgshift] = 0;
+
+        if (_hxmap(hp, pg, &bitpos) != mapp->pgno) {
+            _hxsave(locp, mapp);
+            _hxload(locp, mapp, _hxmap(hp, pg, &bitpos));
+        }
+        xor_map(locp, mapp, pg, 1);
+    } while ((pg = next) && !VREF(locp, pg)
+             && locp->vblob[pg >> hp->pgshift] & BLOB_PAGE);
+
+    if (mapp->pgno != mpg) {
+        _hxsave(locp, mapp);
+        _hxload(locp, mapp, mpg);
+    }
+}
+
+// recover: dump what look like records from the bad tail of a page.
+//  The stored hash is not checked: reinsertion rehashes the record.
 static void
 recover(HXLOCAL * locp, HXBUF const *bufp, FILE * fp)
 {
@@ -485,13 +644,12 @@ recover(HXLOCAL * locp, HXBUF const *bufp, FILE * fp)
 
     while (recp < endp) {
 
-        if (!RECHASH(recp) || !RECLENG(recp)) {
+        if (!RECHASH(recp) || RECLENG(recp) <= (unsigned)HASH_TAIL(hp)) {
 
             recp += sizeof(PAGENO) - 1;
 
         } else if (RECSIZE(recp) > (unsigned)(endp - recp)
-                   || !hx_test(hp, RECDATA(recp), RECLENG(recp))
-                   || hx_hash(hp, recp) != RECHASH(recp)) {
+                   || !hx_test(hp, RECDATA(recp), USERLENG(hp, recp))) {
             ++recp;
 
         } else {
@@ -45,7 +45,8 @@
 HXRET
 hxcreate(char const *name, int mode, int pgsize, char const *udata, int uleng)
 {
-    if (pgsize && (pgsize < HX_MIN_PGSIZE || pgsize & (pgsize - 1)))
+    if (pgsize && (pgsize < HX_MIN_PGSIZE || pgsize > HX_MAX_PGSIZE
+                   || pgsize & (pgsize - 1)))
         return HXERR_BAD_REQUEST;
 
     int     fd = open(name, CREATE, mode & 0777);
@@ -69,9 +70,11 @@ hxcreate(char const *name, int mode, int pgsize, char const *udata, int uleng)
         return HXERR_BAD_REQUEST;
     }
 
-    STSH(pgsize, &rp->pgsize);
+    STSH(pgsize < HX_MAX_PGSIZE ? pgsize : 0, &rp->pgsize);
     STSH(HXVERSION, &rp->version);
     STSH(uleng, &rp->uleng);
+    STSH((mode & HX_HASH64 ? ROOT_HASH64 : 0)
+         | (mode >> 16 & ROOT_PGRATE), &rp->flags);
 
     int     ret = HXOKAY;
 
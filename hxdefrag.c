@@ -0,0 +1,174 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// SYNOPSIS
+//  int hxdefrag(HXFILE *hp, int budget)
+//
+// DESCRIPTION
+//  "hxdefrag" moves overflow pages so that each chain's pages
+//  lie just after its head, in ascending order. A page is moved
+//  to the first free overflow page after its predecessor in the
+//  chain, if that is closer than where it is now. It visits
+//  chains from where the previous call stopped, and stops after
+//  moving about (budget) pages.
+//
+// RETURNS
+//  <0  an error
+//  >=0 number of pages moved; 0 means the pass reached the
+//      end of the file with nothing (more) to move.
+//
+// IMPLEMENTATION
+//  Chains are locked one at a time, as "hxpurge" does, so other
+//  processes keep using the file. A chain's predecessor links
+//  are known from walking it, so no file-wide reference table
+//  (vnext/vrefs, as in "hxfix") is needed.
+//  A tail page shared with other chains is not moved, since the
+//  other chains (which are not locked) link to it. Pages that
+//  are not tails belong to one chain.
+//  A move writes the copy, relinks its predecessor, then frees
+//  the old page, so a crash leaves at worst an orphan page
+//  that "hxfix" reclaims.
+
+#include "_hx.h"
+
+static int _defchain(HXLOCAL *, int budget);
+static int _owned(HXLOCAL const *, HXBUF const *);
+static void _unmap(HXLOCAL *, PAGENO);
+
+//--------------|---------------------------------------------
+HXRET
+hxdefrag(HXFILE * hp, int budget)
+{
+    HXLOCAL loc, *locp = &loc;
+    PAGENO  pg;
+    int     moved = 0;
+
+    if (!hp || budget < 1 || !(hp->mode & HX_UPDATE) || SCANNING(hp))
+        return HXERR_BAD_REQUEST;
+
+    ENTER(locp, hp, NULL, 3);
+
+    for (pg = hp->fraghint; moved < budget; ++pg) {
+        if (!IS_HEAD(hp, pg))
+            continue;
+
+        // A hash whose head is (pg), while (pg) is in the file.
+        locp->hash = (HXHASH64) REV_HASH(_hxf2d(hp, pg)) << 32;
+        _hxlockset(locp, HEAD_LOCK);
+        if (locp->head != pg) {
+            pg = 0;
+            break;
+        }
+        if (IS_MMAP(hp))
+            _hxremap(locp);
+
+        moved += _defchain(locp, budget - moved);
+        _hxunlock(locp, 0, 0);
+    }
+
+    hp->fraghint = pg;
+    DEBUG2("moved=%d next=%u", moved, pg);
+    LEAVE(locp, moved);
+}
+
+//--------------|---------------------------------------------
+// _defchain: move pages of the chain at locp->head nearer to
+//  their predecessors. Returns the number of pages moved.
+static int
+_defchain(HXLOCAL * locp, int budget)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *prevp = &locp->buf[0], *currp = &locp->buf[1];
+    HXBUF  *newp = &locp->buf[2];
+    int     moved = 0, loops = HX_MAX_CHAIN;
+
+    _hxload(locp, prevp, locp->head);
+
+    while (prevp->next && moved < budget) {
+        PAGENO  pg = prevp->next, prev = prevp->pgno;
+        PAGENO  from = (prev / hp->pgrate + 1) * hp->pgrate;
+        PAGENO  below = pg > prev ? pg : 2 * prev - pg + 1;
+
+        if (!--loops)
+            LEAVE(locp, HXERR_BAD_FILE);
+
+        _hxload(locp, currp, pg);
+        if (pg != from && from < below && _owned(locp, currp)
+            && _hxfindnear(locp, newp, from, below)) {
+            PAGENO  to = newp->pgno;
+
+            DEBUG3("head=%u move %u -> %u after %u", locp->head, pg, to,
+                   prev);
+            SCRUB(newp);
+            _unmap(locp, to);
+            _hxlock(locp, to, 1);
+
+            _hxmove(locp, currp, to);
+            _hxsave(locp, currp);
+            LINK(prevp, to);
+            _hxsave(locp, prevp);
+
+            _hxalloc(locp, pg, 0);
+            _hxfresh(locp, newp, pg);
+            _hxsave(locp, newp);
+            _unmap(locp, pg);
+            _hxunlock(locp, pg, 1);
+            ++moved;
+        }
+
+        if (!IS_HEAD(hp, prevp->pgno))
+            _hxunlock(locp, prevp->pgno, 1);
+        SWAP(prevp, currp);
+    }
+
+    return moved;
+}
+
+// _owned: whether (bufp), a page of the chain at locp->head,
+//  belongs to that chain alone.
+static int
+_owned(HXLOCAL const *locp, HXBUF const *bufp)
+{
+    char const *rp, *ep;
+
+    if (!bufp->used)
+        return 0;
+    if (bufp->next)
+        return 1;
+
+    FOR_EACH_REC(rp, bufp, ep)
+        if (_hxhead(locp, RECHASH64(locp->file, rp)) != locp->head)
+        return 0;
+
+    return 1;
+}
+
+// _unmap: release the lock _hxalloc took on the map page
+//  for (pg), so that a long chain does not fill lockv[].
+static void
+_unmap(HXLOCAL * locp, PAGENO pg)
+{
+    int     bitpos;
+    PAGENO  mpg = _hxmap(locp->file, pg, &bitpos);
+
+    if (_hxislocked(locp, mpg))
+        _hxunlock(locp, mpg, 1);
+}
+
+// EOF
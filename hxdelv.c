@@ -0,0 +1,387 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// SYNOPSIS
+//  int hxdelv(HXFILE *hp, char const *const *recv, int nrecs)
+//  int hxpurge(HXFILE *hp, HX_PURGE_FN fn, void *ctx)
+//
+// DESCRIPTION
+//  "hxdelv" deletes every record whose key matches one of
+//  recv[0..nrecs-1]. It is equivalent to calling "hxdel" for
+//  each key, but much cheaper for large key sets.
+//  "hxpurge" deletes every record for which fn(rec,leng,ctx)
+//  returns nonzero. "fn" must not call hx functions on (hp).
+//
+// RETURNS
+//  <0  an error
+//  >=0 number of records deleted
+//
+// IMPLEMENTATION
+//  Both walk a chain once, purging all matching records from
+//  each page in one pass. As in "hxput", records are shifted
+//  towards the head of the chain as pages shrink, and tail pages
+//  that no longer hold records for the chain are unlinked.
+//  Emptied overflow pages are not freed one at a time (each
+//  "_hxalloc" is a read-modify-write of a map byte); they are
+//  collected, then cleared in the bitmap with one load/save of
+//  each map page affected. The pages of deleted blobs are freed
+//  after them. "fn" sees the whole of a blob record.
+//
+//  "hxdelv" locks the whole file for the duration of the call,
+//  sorts the keys by (head,hash) and visits only the chains
+//  that have keys. "hxpurge" visits every chain, locking one
+//  chain at a time (as "hxdel" does), and frees pages per chain.
+//  Chains added by concurrent splits are visited, since the
+//  file size is rechecked for each head.
+//  Both sample the load of the chains they walk, and in a file
+//  with an "hxautoshrink" policy, trim the file at the end.
+
+#include <assert.h>
+
+#include "_hx.h"
+
+typedef struct {
+    char const *recp;           // NULL once its record is deleted.
+    HXHASH64 hash;
+    PAGENO  head;
+} DELKEY;
+
+// DELSET: what _delchain removes; either keys or a predicate.
+typedef struct {
+    DELKEY *keyv;
+    int     nkeys, left;        // left < 0: never stop early
+    HX_PURGE_FN fn;
+    void   *ctx;
+} DELSET;
+
+static int _delchain(HXLOCAL *, DELSET *, int *nfreep);
+static int _delrecs(HXLOCAL *, HXBUF *, DELSET *);
+static void _freeblobs(HXLOCAL *);
+static void _freepages(HXLOCAL *, int nfree);
+static int _match(HXLOCAL *, DELSET *, char const *rp);
+
+static int
+cmpkey(DELKEY const *a, DELKEY const *b)
+{
+    return a->head != b->head ? (a->head < b->head ? -1 : 1)
+        : a->hash < b->hash ? -1 : a->hash > b->hash;
+}
+
+static int
+cmppgno(PAGENO const *a, PAGENO const *b)
+{
+    return *a < *b ? -1 : *a > *b;
+}
+
+//--------------|---------------------------------------------
+HXRET
+hxdelv(HXFILE * hp, char const *const *recv, int nrecs)
+{
+    HXLOCAL loc, *locp = &loc;
+    DELKEY *keyv;
+    int     i, j, nfree = 0, ndel = 0;
+
+    if (!hp || nrecs < 0 || (nrecs && !recv)
+        || !(hp->mode & HX_UPDATE) || SCANNING(hp))
+        return HXERR_BAD_REQUEST;
+
+    if (!nrecs)
+        return 0;
+
+    ENTER(locp, hp, NULL, 3);
+    _hxlock(locp, 0, 0);
+    _hxsize(locp);
+    if (IS_MMAP(hp))
+        _hxremap(locp);
+
+    locp->delv = keyv = malloc(nrecs * sizeof *keyv);
+    locp->freev = calloc(locp->npages / hp->pgrate + 1, sizeof(PAGENO));
+
+    for (i = 0; i < nrecs; ++i) {
+        HXHASH64 hash = _hxhash(hp, recv[i]);
+
+        keyv[i] = (DELKEY) {
+        recv[i], hash, _hxhead(locp, hash)};
+    }
+
+    qsort(keyv, nrecs, sizeof *keyv, (cmpfn_t) cmpkey);
+
+    for (i = 0; i < nrecs; i = j) {
+        for (j = i + 1; j < nrecs && keyv[j].head == keyv[i].head; ++j) {
+        }
+
+        DELSET  set = {.keyv = keyv + i,.nkeys = j - i,.left = j - i };
+
+        locp->hash = keyv[i].hash;
+        _hxpoint(locp);
+        ndel += _delchain(locp, &set, &nfree);
+    }
+
+    _freepages(locp, nfree);
+    _freeblobs(locp);
+    DEBUG2("nrecs=%d deleted=%d freed=%d", nrecs, ndel, nfree);
+    while (_hxautotrim(locp)) {
+    }
+
+    LEAVE(locp, ndel);
+}
+
+//--------------|---------------------------------------------
+HXRET
+hxpurge(HXFILE * hp, HX_PURGE_FN fn, void *ctx)
+{
+    HXLOCAL loc, *locp = &loc;
+    DELSET  set = {.left = -1,.fn = fn,.ctx = ctx };
+    PAGENO  pg;
+    int     nfree, ndel = 0;
+
+    if (!hp || !fn || !(hp->mode & HX_UPDATE) || SCANNING(hp))
+        return HXERR_BAD_REQUEST;
+
+    ENTER(locp, hp, NULL, 3);
+    locp->freev = calloc(HX_MAX_CHAIN + 1, sizeof(PAGENO));
+
+    for (pg = 1;; ++pg) {
+        if (!IS_HEAD(hp, pg))
+            continue;
+
+        // A hash whose head is (pg), while (pg) is in the file.
+        locp->hash = (HXHASH64) REV_HASH(_hxf2d(hp, pg)) << 32;
+        _hxlockset(locp, HEAD_LOCK);
+        if (locp->head != pg)
+            break;
+        if (IS_MMAP(hp))
+            _hxremap(locp);
+
+        nfree = 0;
+        ndel += _delchain(locp, &set, &nfree);
+        _freepages(locp, nfree);
+        _freeblobs(locp);
+        _hxunlock(locp, 0, 0);
+    }
+
+    if (SHRINK_FLOOR(hp)) {
+        _hxlock(locp, 0, 0);
+        _hxsize(locp);
+        if (IS_MMAP(hp))
+            _hxremap(locp);
+        while (_hxautotrim(locp)) {
+        }
+    }
+
+    DEBUG2("deleted=%d", ndel);
+    LEAVE(locp, ndel);
+}
+
+//--------------|---------------------------------------------
+// _delchain: delete all records in (set) from the chain at
+//  locp->head, compacting it as "hxput" does.
+static int
+_delchain(HXLOCAL * locp, DELSET * setp, int *nfreep)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *currp = &locp->buf[0], *prevp = &locp->buf[1];
+    int     ndel = 0, loops = HX_MAX_CHAIN;
+    double  chainbytes = 0;
+
+    _hxload(locp, currp, locp->head);
+
+    while (1) {
+        PAGENO  nextpg = currp->next;
+        int     skip = 0;
+
+        if (!--loops)
+            LEAVE(locp, HXERR_BAD_FILE);
+
+        if (setp->left)
+            ndel += _delrecs(locp, currp, setp);
+        chainbytes += currp->used;
+
+        if (currp->used && !IS_HEAD(hp, currp->pgno) && SHRUNK(prevp))
+            skip = !_hxshift(locp, locp->head, 0, currp, prevp, NULL);
+
+        // Same unlink/free rules as hxput.
+        if (IS_HEAD(hp, currp->pgno)) {
+            skip = 0;
+        } else if (!currp->used) {
+            skip = 1;
+            locp->freev[(*nfreep)++] = currp->pgno;
+            SCRUB(currp);
+        } else if (currp->next || !SHRUNK(currp)) {
+            skip = 0;
+        } else if (!skip) {
+            char const *rp, *ep;
+
+            FOR_EACH_REC(rp, currp, ep)
+                if (locp->head == _hxhead(locp, RECHASH64(hp, rp)))
+                break;
+            skip = rp == ep;
+        }
+        if (skip)
+            LINK(prevp, nextpg);
+        else
+            SWAP(prevp, currp);
+
+        _hxsave(locp, currp);
+
+        if (!prevp->next || (!setp->left && !SHRUNK(prevp)))
+            break;
+
+        _hxload(locp, currp, prevp->next);
+    }
+
+    _hxsave(locp, prevp);
+
+    // The whole chain was seen: sample its load, as hxput does.
+    if (!prevp->next)
+        _hxsample(hp, chainbytes);
+    return ndel;
+}
+
+// _delrecs: remove records matching (set) from one page,
+//  in a single pass.
+static int
+_delrecs(HXLOCAL * locp, HXBUF * bufp, DELSET * setp)
+{
+    char   *rp = bufp->data, *ep = rp + bufp->used, *dp = rp;
+    int     ndel = 0, size;
+
+    for (; rp < ep; rp += size) {
+        size = RECSIZE(rp);
+        if (_match(locp, setp, rp)) {
+            if (IS_BLOB(rp)) {
+                locp->blobv = realloc(locp->blobv, (locp->nblobs + 1)
+                                      * sizeof *locp->blobv);
+                locp->blobv[locp->nblobs++] = BLOB_REF(locp->file, rp);
+            }
+            ++ndel;
+            continue;
+        }
+
+        if (dp != rp)
+            memmove(dp, rp, size);
+        dp += size;
+    }
+
+    if (ndel) {
+        bufp->used = dp - bufp->data;
+        bufp->recs -= ndel;
+        STAIN(bufp);
+    }
+
+    return ndel;
+}
+
+// _freeblobs: free the pages of the blobs _delrecs deleted.
+static void
+_freeblobs(HXLOCAL * locp)
+{
+    while (locp->nblobs)
+        _hxblobfree(locp, &locp->buf[0], locp->blobv[--locp->nblobs]);
+}
+
+// _freepages: zero the emptied overflow pages, then clear their
+//  bits with one load/save per map page.
+static void
+_freepages(HXLOCAL * locp, int nfree)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *bufp = &locp->buf[0];
+    PAGENO *freev = locp->freev;
+    int     i, bitpos;
+
+    qsort(freev, nfree, sizeof *freev, (cmpfn_t) cmppgno);
+    if (nfree && freev[0] < hp->freehint)
+        hp->freehint = freev[0];
+
+    for (i = 0; i < nfree; ++i) {
+        _hxfresh(locp, bufp, freev[i]);
+        _hxsave(locp, bufp);
+    }
+
+    for (i = 0; i < nfree;) {
+        PAGENO  mpg = _hxmap(hp, freev[i], &bitpos);
+
+        _hxload(locp, bufp, mpg);
+        do {
+            BYTE   *bp = (BYTE *) & bufp->data[bitpos >> 3];
+            BYTE    bit = 1 << (bitpos & 7);
+
+            DEBUG3("free pgno=%u mpg=%u bit=%d", freev[i], mpg, bitpos);
+            if (!(*bp & bit))
+                LEAVE(locp, HXERR_BAD_FILE);
+            *bp &= ~bit;
+        } while (++i < nfree && _hxmap(hp, freev[i], &bitpos) == mpg);
+
+        STAIN(bufp);
+        _hxsave(locp, bufp);
+    }
+}
+
+// _match: test one record against (set). hxdelv keys are
+//  sorted by hash; a matched key is consumed. A predicate
+//  only sees records of the current chain, since records in
+//  a shared tail page belong to other (unlocked) chains.
+static int
+_match(HXLOCAL * locp, DELSET * setp, char const *rp)
+{
+    HXFILE const *hp = locp->file;
+    HXHASH64 hash = RECHASH64(hp, rp);
+
+    if (setp->fn) {
+        if (_hxhead(locp, hash) != locp->head)
+            return 0;
+        if (!IS_BLOB(rp))
+            return setp->fn(RECDATA(rp), USERLENG(hp, rp), setp->ctx);
+
+        int     leng = BLOB_REF(hp, rp).leng;
+
+        if (locp->memsize < leng) {
+            free(locp->membase);
+            locp->membase = locp->mem = malloc(locp->memsize = leng);
+        }
+        _hxblobget(locp, rp, locp->mem, leng);
+        return setp->fn(locp->mem, leng, setp->ctx);
+    }
+
+    DELKEY *keyv = setp->keyv;
+    int     lo = 0, hi = setp->nkeys;
+
+    while (lo < hi) {
+        int     mid = (lo + hi) / 2;
+
+        if (keyv[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (; lo < setp->nkeys && keyv[lo].hash == hash; ++lo) {
+        if (keyv[lo].recp
+            && !KIT_DIFF(hp, keyv[lo].recp, RECDATA(rp))) {
+            keyv[lo].recp = NULL;
+            --setp->left;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//EOF
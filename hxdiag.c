@@ -70,7 +70,7 @@ _hxcheckbuf(HXLOCAL const *locp, HXBUF const *bufp)
         int     lastbit, pos;
         PAGENO  lastmap = locp->npages - 1;
 
-        lastmap = _hxmap(hp, lastmap - lastmap % HXPGRATE, &lastbit);
+        lastmap = _hxmap(hp, lastmap - lastmap % hp->pgrate, &lastbit);
         if (bufp->pgno == lastmap) {    // All bits beyond lastbit must be zero.
             BYTE    mask = -2 << (lastbit & 7);
 
@@ -81,18 +81,20 @@ _hxcheckbuf(HXLOCAL const *locp, HXBUF const *bufp)
         }
 
     } else {                    // DATA page.
-        if (bufp->next && bufp->next % HXPGRATE)
+        if (bufp->next && bufp->next % hp->pgrate)
             return bad_next;
         if (bufp->used >= DATASIZE(hp))
             return bad_used;
+        if (HAS_BLOBS(hp) && IS_BLOBPG(hp, bufp))
+            return bufp->used > BLOB_DATA(hp) ? bad_used : HXOKAY;
 
         // If this is a tail (overflow) page, at least one
         // record must have the same _hxhead as locp->head.
         // Otherwise, EVERY record must match locp->head.
         int     recs = 0, is_tail = bufp->used && !bufp->next &&
-            !IS_HEAD(bufp->pgno);
+            !IS_HEAD(hp, bufp->pgno);
         char   *recp, *endp;
-        PAGENO  head = IS_HEAD(bufp->pgno) ? bufp->pgno : locp->head;
+        PAGENO  head = IS_HEAD(hp, bufp->pgno) ? bufp->pgno : locp->head;
 
         FOR_EACH_REC(recp, bufp, endp) {
             unsigned size = RECSIZE(recp);
@@ -100,12 +102,12 @@ _hxcheckbuf(HXLOCAL const *locp, HXBUF const *bufp)
             ++recs;
             if (size < MINRECSIZE || size > (unsigned)(endp - recp))
                 return bad_rec_size;
-            if (!hx_test(hp, RECDATA(recp), size - sizeof(HXREC)))
+            if (!hx_test(hp, RECDATA(recp), USERLENG(hp, recp)))
                 return bad_rec_test;
             if (head && !is_tail &&
-                head != _hxhead(locp, hx_hash(hp, RECDATA(recp)))) {
+                head != _hxhead(locp, _hxhash(hp, RECDATA(recp)))) {
                 DEBUG("bad head:%d",
-                      _hxhead(locp, hx_hash(hp, RECDATA(recp))));
+                      _hxhead(locp, _hxhash(hp, RECDATA(recp))));
                 return bad_rec_hash;
             }
         }
@@ -212,13 +214,20 @@ _hxprbuf(HXLOCAL const *locp, HXBUF const *bufp, FILE * fp)
 
         //for (i = 0; i < bufp->nredex; ++i, sep = ',') fprintf(fp, "%c%d", sep, bufp->redexv[i]); putc('\n', fp);
 
+        if (IS_BLOBPG(hp, bufp)) {
+            fprintf(fp, " BLOB");
+            dx(fp, bufp->data, IMIN(bufp->used, 32));
+            putc('\n', fp);
+            return;
+        }
+
         FOR_EACH_REC(recp, bufp, endp) {
-            HXHASH  h = RECHASH(recp);
-            int     len = RECLENG(recp);
+            HXHASH64 h = RECHASH64(hp, recp);
+            int     len = USERLENG(hp, recp);
             char const *cp = RECDATA(recp);
 
             fprintf(fp, " %5" FOFF "d: %08X %5u [%d]",
-                    recp - bufp->data, h, _hxhead(locp, h), len);
+                    recp - bufp->data, (HXHASH) h, _hxhead(locp, h), len);
             if (hx_test(hp, cp, len)) {
                 hx_save(hp, cp, len, str, strsize);
                 fprintf(fp, "\t\"%.*s\"%s", hxprwid, str,
@@ -254,8 +263,8 @@ void
 _hxprloc(HXLOCAL const *locp)
 {
     int save = hxdebug; hxdebug = 1;
-    DEBUG("HXLOCAL npages:%d dpages:%d split:%d mask:%d hash:%08X head:%d mode:%d mylock:%d changed:%d",
-            locp->npages, locp->dpages, SPLIT_PAGE(locp), locp->mask, locp->hash, locp->head,
+    DEBUG("HXLOCAL npages:%d dpages:%d split:%d mask:%d hash:%016llX head:%d mode:%d mylock:%d changed:%d",
+            locp->npages, locp->dpages, SPLIT_PAGE(locp), locp->mask, (unsigned long long)locp->hash, locp->head,
             locp->mode, locp->mylock, locp->changed);
     _hxprfile(locp->file);
     hxdebug = save;
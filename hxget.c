@@ -75,8 +75,14 @@ hxget(HXFILE * hp, char *rp, int size)
         LEAVE(locp, 0);
 
     recp = bufp->data + rpos;
-    leng = RECLENG(recp);
-    memcpy(rp, RECDATA(recp), IMIN(leng, size < 0 ? -size - 1 : size));
+    if (size < 0)
+        size = -size - 1;
+    if (IS_BLOB(recp)) {
+        leng = _hxblobget(locp, recp, rp, size);
+    } else {
+        leng = USERLENG(hp, recp);
+        memcpy(rp, RECDATA(recp), IMIN(leng, size));
+    }
 
     LEAVE(locp, leng);
 }
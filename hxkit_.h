@@ -0,0 +1,85 @@
+// Copyright (C) 2009-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// IF YOU ARE UNABLE TO WORK WITH GPL2, CONTACT ME.
+//-------------------------------------------------------------------
+
+// hxkit_.h: the default record type ("key\0val\0") as a kit.
+//  A kit is a header of static inline hxkit_diff and hxkit_hash
+//  (and hxkit_hash64, if HXKIT_HASH64 is defined) with the
+//  HX_DIFF_FN/HX_HASH_FN signatures, and HXKIT_TYPE, the type
+//  string of the files it serves. Compiling libhx with
+//  -DHX_KIT='"hxkit_.h"' puts the kit in every hot path (see
+//  KIT_DIFF in _hx.h), for a program of one record type.
+//  hx_.c exports these same functions for hx_.so.
+
+#ifndef HXKIT__H
+#define HXKIT__H
+#include "hx.h"
+
+// HXKIT_TYPE: the record type (hxcreate udata) of the kit.
+#define HXKIT_TYPE  ""
+#define HXKIT_HASH64
+
+static inline int
+hxkit_diff(char const *ap, char const *bp, char const *udata, int uleng)
+{
+    (void)udata, (void)uleng;
+    while (1) {
+        if (*ap != *bp)
+            return 1;
+        if (*ap == 0)
+            return 0;
+        ++ap, ++bp;
+    }
+}
+
+static inline HXHASH
+hxkit_hash(char const *recp, char const *udata, int uleng)
+{
+    (void)udata, (void)uleng;
+    HXHASH  ret = 2166136261U;
+
+    while (*recp && *recp != 0)
+        ret = ret * 16777619U ^ *recp++;
+
+    // For keys < 5bytes, scrambling the bits is reqd:
+    ret += ret << 13;
+    ret ^= ret >> 7;
+    ret += ret << 3;
+    ret ^= ret >> 17;
+    ret += ret << 5;
+    return ret;
+}
+
+// hxkit_hash64: FNV-1 64, with a final mix so that the high bits
+//  (which choose the head page) depend on every key byte.
+static inline HXHASH64
+hxkit_hash64(char const *recp, char const *udata, int uleng)
+{
+    (void)udata, (void)uleng;
+    HXHASH64 ret = 14695981039346656037ULL;
+
+    while (*recp)
+        ret = ret * 1099511628211ULL ^ *recp++;
+
+    ret ^= ret >> 31;
+    ret *= 0x7FB5D329728EA185ULL;
+    ret ^= ret >> 27;
+    return ret;
+}
+#endif //HXKIT__H
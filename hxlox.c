@@ -54,7 +54,7 @@ _hxaddlock(HXFILE * hp, PAGENO pg)
     *pp = pg;
 }
 
-// NOTE: When npages < HXPGRATE+2, hxlockset will
+// NOTE: When npages < pgrate+2, hxlockset will
 //  have locked page 1, even if it hasn't locked (2,3,5).
 int
 _hxislocked(HXLOCAL const *locp, PAGENO pg)
@@ -83,7 +83,7 @@ _hxlock(HXLOCAL * locp, PAGENO pgno, COUNT count)
     assert(count == 1           // ROOT and OVFL and some HEAD pages
            || (count == 0 && pgno == 0) //FILE or BODY lock
            || (count == 0 && pgno == locp->npages)  //BEYOND
-           || (count < HXPGRATE && IS_HEAD(pgno)));
+           || (count < hp->pgrate && IS_HEAD(hp, pgno)));
 
     // Attempting to RE-lock a page can EDEADLK !?
     if (!pgno && !count) {
@@ -118,10 +118,10 @@ _hxlock(HXLOCAL * locp, PAGENO pgno, COUNT count)
     // in (_hxsave?_hxload?_hxfresh) that any page that is
     //  (saved,loaded,cleared) has a lock covering it.
 
-    if (hxdebug && count && pgno < locp->npages && IS_HEAD(pgno)) {
+    if (hxdebug && count && pgno < locp->npages && IS_HEAD(hp, pgno)) {
         PAGENO *pp = hp->lockv;
 
-        while (*pp && (!IS_HEAD(*pp) || pgno <= *pp))
+        while (*pp && (!IS_HEAD(hp, *pp) || pgno <= *pp))
             ++pp;
         if (*pp)
             DEBUG("pgno=%u count=%d after %u", pgno, count, *pp);
@@ -171,7 +171,7 @@ _hxlockset(HXLOCAL * locp, LOCKPART part)
         return;
     }
 
-    if ((int)locp->npages < HXPGRATE * 2) {
+    if ((int)locp->npages < hp->pgrate * 2) {
         _hxlock(locp, 0, 0);
         hp->lockpart = BOTH_LOCK;
         _hxsize(locp);
@@ -181,7 +181,7 @@ _hxlockset(HXLOCAL * locp, LOCKPART part)
 
     hp->lockpart = part;
 
-    PAGENO  pgv[2 * HXPGRATE] = { }
+    PAGENO  pgv[2 * HXPGRATE_MAX] = { }
     , *pp, oldsize = 0;
 
     while (1) {
@@ -232,7 +232,7 @@ _hxunlock(HXLOCAL * locp, PAGENO start, PAGENO count)
     assert((start == 0 && count == 0)
            || (start == 1)      // see _hxlockset
            || (start == locp->npages && count == 0)
-           || (!IS_HEAD(start) && count == 1));
+           || (count == 1));    // ovfl, or a head in _hxlockset retry
 
     if (!count)
         hp->lockpart = NONE_LOCK;
@@ -242,8 +242,10 @@ _hxunlock(HXLOCAL * locp, PAGENO start, PAGENO count)
         hp->locked &= ~LOCKED_ROOT;
     if (!count)
         hp->locked &= ~LOCKED_BODY & ~LOCKED_BEYOND;
+    // count == 0 is everything from start onward; the file may
+    //  have been truncated below a page still in lockv.
     if (!count)
-        count = locp->npages;
+        count = (PAGENO) - 1 - start;
 
     // Delete locked pages from lockv:
     PAGENO *p = hp->lockv, *pp = p;
@@ -263,12 +265,12 @@ _hxunlock(HXLOCAL * locp, PAGENO start, PAGENO count)
 void
 _hxsplits(HXFILE * hp, PAGENO * pgv, PAGENO newpg)
 {
-    for (; IS_HEAD(newpg) || IS_MAP(hp, newpg); ++newpg) {
-        if (IS_HEAD(newpg)) {
+    for (; IS_HEAD(hp, newpg) || IS_MAP(hp, newpg); ++newpg) {
+        if (IS_HEAD(hp, newpg)) {
             // Compute split page:
-            PAGENO *pp = pgv, pg = _hxf2d(newpg);
+            PAGENO *pp = pgv, pg = _hxf2d(hp, newpg);
 
-            pg = _hxd2f(pg - ((MASK(pg + 1) + 1) >> 1));
+            pg = _hxd2f(hp, pg - ((MASK(pg + 1) + 1) >> 1));
             // Insert split page into pgv[], retaining
             //  descending order and terminal (0):
             while (*pp > pg)
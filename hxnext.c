@@ -82,7 +82,7 @@ hxnext(HXFILE * hp, char *rp, int size)
             // Advance to next page
             PAGENO  next = !(hp->mode & HX_UPDATE) ? --hp->head
                 : bufp->next ? bufp->next
-                : !--hp->head ? 0 : (hp->head -= !IS_HEAD(hp->head));
+                : !--hp->head ? 0 : (hp->head -= !IS_HEAD(hp, hp->head));
             if (!next) {
                 _hxrel(locp);
                 LEAVE(locp, 0);
@@ -97,6 +97,9 @@ hxnext(HXFILE * hp, char *rp, int size)
             } else {
                 _hxload(locp, bufp, next);
             }
+            // A READ scan reaches blob pages: they hold no records.
+            if (IS_BLOBPG(hp, bufp))
+                bufp->used = 0;
 
         } else {
             assert(hp->currpos < bufp->used);
@@ -104,11 +107,15 @@ hxnext(HXFILE * hp, char *rp, int size)
 
             // In UPDATE mode, only return recs for curr head
             if (!(hp->mode & HX_UPDATE)
-                || _hxhead(locp, RECHASH(recp)) == hp->head) {
+                || _hxhead(locp, RECHASH64(hp, recp)) == hp->head) {
 
                 hp->recsize = RECSIZE(recp);
-                locp->ret = RECLENG(recp);
-                memcpy(rp, RECDATA(recp), IMIN(size, locp->ret));
+                if (IS_BLOB(recp)) {
+                    locp->ret = _hxblobget(locp, recp, rp, size);
+                } else {
+                    locp->ret = USERLENG(hp, recp);
+                    memcpy(rp, RECDATA(recp), IMIN(size, locp->ret));
+                }
                 LEAVE(locp, locp->ret);
             }
 
@@ -34,10 +34,11 @@ hxopen(char const *name, HXMODE mode)
     HXFILE *hp = 0;             // return value
     HXROOT  hd;                 // file header
     int     fd;
-    COUNT   pgsize = 0, version = 0;
+    unsigned pgsize = 0;
+    COUNT   version = 0, flags = 0;
     off_t   uleng = 0, mlen = 0;
     char   *udata = NULL, *vp;
-    int     fix = mode & HX_RECOVER;
+    int     fix = mode & HX_RECOVER, kitok = 1;
     int     omode = (mode & HX_UPDATE) ? O_RDWR : O_RDONLY;
 
     if ((vp = getenv("HXDEBUG")))
@@ -64,7 +65,14 @@ hxopen(char const *name, HXMODE mode)
         pgsize = LDUS(&hd.pgsize);
         //XXX:If version is a DIFFERENT valid version, do not attempt to fix.
         version = LDUS(&hd.version);
+        // 64K does not fit in (pgsize); a zeroed root is not 64K.
+        //  64K pages came with version 2.3, which keeps in-page
+        //  (leng) clear of REC_BLOB.
+        if (!pgsize && OK_VERSION(version) && version >= 0x0203)
+            pgsize = HX_MAX_PGSIZE;
         uleng = LDUS(&hd.uleng);
+        if (version >= 0x0201)
+            flags = LDUS(&hd.flags);
     }
 
     if (TWIXT(pgsize, HX_MIN_PGSIZE, HX_MAX_PGSIZE)
@@ -77,14 +85,24 @@ hxopen(char const *name, HXMODE mode)
             ? lseek(fd, 0L, SEEK_END) : -1;
     }
 
-    if (fix ||
-        (OK_VERSION(version) && udata && mlen > 0 && mlen % pgsize == 0)) {
+#ifdef HX_KIT
+    // A kit build serves only the record type of its kit.
+    kitok = !udata || !strcmp(udata, HXKIT_TYPE);
+#endif
+    if (kitok && (fix ||
+        (OK_VERSION(version)
+         && !(flags & ~(ROOT_HASH64 | ROOT_PGRATE | ROOT_SHRINK | ROOT_GROW))
+         && udata && mlen > 0 && mlen % pgsize == 0))) {
 
         hp = (HXFILE *) calloc(1, sizeof(HXFILE));
         hp->mode = mode;
         hp->fileno = fd;
         hp->pgsize = pgsize;
         hp->version = version;
+        hp->flags = flags & (ROOT_HASH64 | ROOT_PGRATE | ROOT_SHRINK
+                             | ROOT_GROW);
+        hp->pgshift = PGRATE_SHIFT(hp->flags);
+        hp->pgrate = 1 << hp->pgshift;
         hp->uleng = uleng;
         hp->udata = udata;
         hp->tail.used = DATASIZE(hp);
@@ -94,8 +112,15 @@ hxopen(char const *name, HXMODE mode)
             if (!(hp->mode & HX_STATIC))
                 hxlib(hp, hp->udata, 0);
         }
-
-        hp->map1 = 8 * HXPGRATE * ROOT_SIZE(hp);
+#ifdef HX_KIT
+        hp->diff = hxkit_diff;
+        hp->hash = hxkit_hash;
+#   ifdef HXKIT_HASH64
+        hp->hash64 = hxkit_hash64;
+#   endif
+#endif
+
+        hp->map1 = 8 * hp->pgrate * ROOT_SIZE(hp);
         errno = 0;
         return hp;
     }
@@ -129,11 +154,18 @@ hxbind(HXFILE * hp, HX_DIFF_FN df, HX_HASH_FN hf,
 {
     hp->diff = df;
     hp->hash = hf;
+    hp->hash64 = NULL;
     hp->load = lf;
     hp->save = sf;
     hp->test = tf;
 }
 
+void
+hxbind64(HXFILE * hp, HX_HASH64_FN hf)
+{
+    hp->hash64 = hf;
+}
+
 static const char stdldpath[] = "/lib:/usr/lib:/usr/local/lib";
 
 int
@@ -142,6 +174,15 @@ hxlib(HXFILE * hp, char const *hxreclib, char **pathp)
     int     ret;
     char const *ep = getenv("LD_LIBRARY_PATH");
 
+    if (_hxbinbind(hp, hxreclib)) {
+        if (hp->dlfile)
+            dlclose(hp->dlfile);
+        hp->dlfile = NULL;
+        if (pathp)
+            *pathp = NULL;
+        return 7;
+    }
+
     if (!ep || !*ep || !(ret = _hxlib(hp, ep, hxreclib, pathp)))
         ret = _hxlib(hp, stdldpath, hxreclib, pathp);
 
@@ -194,6 +235,7 @@ _hxlib(HXFILE * hp, char const *ep, char const *hxreclib, char **pathp)
         if (hp->dlfile)
             dlclose(hp->dlfile);
         hp->dlfile = dlp;
+        hp->hash64 = (HX_HASH64_FN) dlsym(dlp, "hash64");
         hp->load = (HX_LOAD_FN) dlsym(dlp, "load");
         hp->save = (HX_SAVE_FN) dlsym(dlp, "save");
         hp->test = (HX_TEST_FN) dlsym(dlp, "test");
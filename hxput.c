@@ -67,6 +67,10 @@
 //  In the latter case, the search for an insertion point
 //  must restart at the head of chain: either at the
 //  original head, or at a new head just added to the file.
+//  In a file with an "hxautogrow" policy, the file is also split
+//  when the chains hxput walks are, on average, too full; with an
+//  "hxautoshrink" policy, hxput and hxdel trim the last head page
+//  when they are too empty.
 //
 // hxnext and hxput:
 //  It is possible to update a file in the middle of a hxnext
@@ -77,12 +81,21 @@
 //  - increasing a record's size will USUALLY work, but may
 //  get a HXERR_BAD_REQUEST response if the hxput would
 //  cause records to be missed by hxnext.
+//  - a record longer than hxmaxrec can't be put at all.
+//
+// Blobs: in a version 2.3 file, a record longer than hxmaxrec
+//  is put as a stub plus blob pages (see hxblob.c). Its key
+//  must lie in its first hxmaxrec/8 BYTEs. Blob pages are
+//  allocated before the chain is searched, so a blob hxput
+//  locks the whole file; if the stub then cannot be put, they
+//  are freed again.
 
 #include <assert.h>
 
 #include "_hx.h"
 
 //static void reindex(HXLOCAL*, HXBUF*);
+static void fail(HXLOCAL *, char const *stub, HXRET);
 static void sync_save(HXLOCAL *, HXBUF *);
 
 //--------------|---------------------------------------------
@@ -90,45 +103,59 @@ HXRET
 hxput(HXFILE * hp, char const *recp, int leng)
 {
     HXLOCAL loc, *locp = &loc;
+    BLOBREF oldref = { };
+    COUNT   blob = 0;
 
-    if (!hp || leng < 0 || !recp || leng > hxmaxrec(hp)
-        || !(hp->mode & HX_UPDATE) || !hp->test)
+    if (!hp || leng < 0 || !recp || !(hp->mode & HX_UPDATE) || !hp->test
+        || (leng > hxmaxrec(hp) && (!HAS_BLOBS(hp) || SCANNING(hp))))
         return HXERR_BAD_REQUEST;
 
     if (leng && !hx_test(hp, recp, leng))
         return HXERR_BAD_RECORD;
 
-    if (SCANNING(hp) && hx_diff(hp, recp, RECDATA(_hxcurrec(hp))))
+    if (SCANNING(hp) && KIT_DIFF(hp, recp, RECDATA(_hxcurrec(hp))))
         return HXERR_BAD_REQUEST;
 
     ENTER(locp, hp, recp, 3);
+    if (leng > hxmaxrec(hp)) {
+        _hxlock(locp, 0, 0);
+        _hxsize(locp);
+        if (IS_MMAP(hp))
+            _hxremap(locp);
+        recp = _hxblobstub(locp, recp, leng);
+        leng = BLOB_KEEP(hp) + sizeof(BLOBREF);
+        blob = REC_BLOB;
+    }
+
     _hxlockset(locp, leng ? HIGH_LOCK : HEAD_LOCK);
     if (IS_MMAP(hp))
         _hxremap(locp);
 
-    int     may_find = 1, loops = HX_MAX_CHAIN;
-    int     newsize = leng ? leng + sizeof(HXREC) : 0;
+    int     may_find = 1, loops = HX_MAX_CHAIN, split = 0;
+    double  chainbytes = 0;
+    int     newsize = leng ? leng + sizeof(HXREC) + HASH_TAIL(hp) : 0;
     HXBUF  *currp = &locp->buf[0], *prevp = &locp->buf[1];
 
     // If scanning is on an overflow page, and hxdel might
     //  empty the page, hxput after hxnext can't just jump to
     //  the right page, because (prevp) is not loaded,
     //  so deleting currp would hard.
-    _hxload(locp, currp, SCANNING(hp) && (leng || IS_HEAD(hp->buffer.pgno))
+    _hxload(locp, currp, SCANNING(hp) && (leng || IS_HEAD(hp, hp->buffer.pgno))
             ? hp->buffer.pgno : locp->head);
 
     while (1) {
-        int     pos, hindpos, skip = 0;
+        int     pos, skip = 0;
         PAGENO  nextpg = currp->next;
 
         if (!--loops)
-            LEAVE(locp, HXERR_BAD_FILE);
+            fail(locp, blob && newsize ? recp : NULL, HXERR_BAD_FILE);
+        chainbytes += currp->used;
 
         // Search for the key (an old record to be deleted).
         // If SCANNING: the file is locked, and the matching
         //  record must be there.
         pos = !may_find ? -1
-            : !SCANNING(hp) ? _hxfind(locp, currp, locp->hash, recp, &hindpos)
+            : !SCANNING(hp) ? _hxfind(locp, currp, locp->hash, recp, NULL)
             : currp->pgno == hp->buffer.pgno ? hp->currpos : -1;
 
         if (pos >= 0) {
@@ -136,33 +163,27 @@ hxput(HXFILE * hp, char const *recp, int leng)
             COUNT   oldsize = RECSIZE(oldp);
             int     delta = newsize - oldsize;
 
-            locp->ret = RECLENG(oldp);
+            locp->ret = WHOLELENG(hp, oldp);
             may_find = 0;
-            assert(!currp->delta);
-            currp->delpos = pos;
-            currp->delta = delta;
+            if (IS_BLOB(oldp))
+                oldref = BLOB_REF(hp, oldp);
 
             if (!newsize) {     // hxdel or remove after inserted previously.
 
-                _hxremove(currp, pos, oldsize);
-                currp->recs--;
+                _hxdelrec(locp, currp, pos);
                 if (SCANNING(hp))
                     hp->recsize = 0;
 
             } else if (FITS(hp, currp, delta, 0)) { // replace
 
-                if (delta) {
-                    memmove(oldp + newsize, oldp + oldsize,
-                            currp->used - pos - oldsize);
-                    currp->used += delta;
-                    STSH(leng, oldp + sizeof(PAGENO));
+                if (delta || IS_BLOB(oldp) != blob) {
+                    _hxsetrec(locp, currp, pos, recp, leng | blob);
                     if (SCANNING(hp))
                         hp->recsize = newsize;
-                    DEINDEX(currp); // force indexify
+                } else {        // hind[] is unchanged
+                    memcpy(oldp + sizeof(HXREC), recp, leng);
+                    SPOT(currp);
                 }
-
-                memcpy(oldp + sizeof(HXREC), recp, leng);
-                STAIN(currp);
                 newsize = 0;
 
             } else if (SCANNING(hp)) {
@@ -170,35 +191,27 @@ hxput(HXFILE * hp, char const *recp, int leng)
                 // the record, we are committed to inserting the new copy
                 // somewhere else, but that might require changing links
                 // or even growing the file: a NO-NO during a hxnext scan.
-                LEAVE(locp, HXERR_BAD_REQUEST);
+                fail(locp, blob && newsize ? recp : NULL, HXERR_BAD_REQUEST);
 
             } else {            // Delete old version and continue (insert elsewhere).
 
-                _hxremove(currp, pos, oldsize);
-                currp->recs--;
+                _hxdelrec(locp, currp, pos);
             }
         }
 
-        if (currp->used && !IS_HEAD(currp->pgno) && SHRUNK(prevp))
+        if (currp->used && !IS_HEAD(hp, currp->pgno) && SHRUNK(prevp))
             skip = !_hxshift(locp, locp->head, 0, currp, prevp, NULL);
 
         // Insert the new record if it fits.
         if (newsize && FITS(hp, currp, newsize, 1)) {
-
-            HXREC   hdr;
-
-            STLG(locp->hash, &hdr.hash);
-            STSH(leng, &hdr.leng);
-            _hxappend(currp, (char *)&hdr, sizeof hdr);
-            _hxappend(currp, recp, leng);
-            currp->recs++;
+            _hxaddrec(locp, currp, locp->hash, recp, leng | blob);
             newsize = 0;
         }
         // If the current page contains only data of OTHER heads 
         // -- and hence, must be at the END of a chain --
         // unlink it from this chain. If the page is empty,
         // unlink it AND put it in the freemap.
-        if (IS_HEAD(currp->pgno)) {
+        if (IS_HEAD(hp, currp->pgno)) {
             skip = 0;
         } else if (!currp->used) {
             skip = 1;
@@ -211,7 +224,7 @@ hxput(HXFILE * hp, char const *recp, int leng)
             char const *rp, *ep;
 
             FOR_EACH_REC(rp, currp, ep)
-                if (locp->head == _hxhead(locp, RECHASH(rp)))
+                if (locp->head == _hxhead(locp, RECHASH64(hp, rp)))
                 break;
             skip = rp == ep;    // No recs for locp->head in this tail.
         }
@@ -236,7 +249,7 @@ hxput(HXFILE * hp, char const *recp, int leng)
 
         // Unlocking is necessary even if tail is not shared;
         //  it may be hp->tail.pgno in some other process.
-        if (!FILE_HELD(hp) && !IS_HEAD(prevp->pgno))
+        if (!FILE_HELD(hp) && !IS_HEAD(hp, prevp->pgno))
             _hxunlock(locp, prevp->pgno, 1);
 
         // _hxshare/_hxfindfree may update the map (root etc).
@@ -250,7 +263,7 @@ hxput(HXFILE * hp, char const *recp, int leng)
         // After locking the split, no other process can change
         // the file size.
         may_find = 0;
-        COUNT   need = IS_HEAD(prevp->pgno) ? newsize : 0;
+        COUNT   need = IS_HEAD(hp, prevp->pgno) ? newsize : 0;
 
         if (!_hxshare(locp, currp, need)
             && !_hxgetfreed(locp, currp)
@@ -264,12 +277,14 @@ hxput(HXFILE * hp, char const *recp, int leng)
             //  being the newly-added page.
             _hxlock(locp, locp->npages, 0);
             _hxgrow(locp, currp, need, &samehead);
+            split = 1;
             DEBUG3("head=%u samehead=%u", locp->head, samehead);
             if (!samehead) {
                 _hxputfreed(locp, currp);
                 _hxpoint(locp);
                 _hxload(locp, currp, locp->head);
                 loops = HX_MAX_CHAIN;
+                chainbytes = 0;
                 continue;
             }
         }
@@ -291,6 +306,12 @@ hxput(HXFILE * hp, char const *recp, int leng)
 
     sync_save(locp, prevp);
     _hxflushfreed(locp, currp);
+    if (oldref.first)
+        _hxblobfree(locp, currp, oldref);
+
+    // hxput saw the whole chain: sample its load.
+    if (!prevp->next && !split)
+        _hxautoshape(locp, chainbytes);
 
     if (HEAD_HELD(locp)) {
         hp->hold = 0;
@@ -301,6 +322,23 @@ hxput(HXFILE * hp, char const *recp, int leng)
 }
 
 //--------------|---------------------------------------------
+// fail: LEAVE with (ret). If (stub) is a blob stub that is not
+//  yet in any page, first free the blob pages _hxblobstub wrote
+//  for it, since nothing else refers to them.
+static void
+fail(HXLOCAL * locp, char const *stub, HXRET ret)
+{
+    if (stub) {
+        char const *refp = stub + BLOB_KEEP(locp->file);
+        BLOBREF ref = { LDUL(refp), LDUL(refp + sizeof(PAGENO)) };
+
+        SCRUB(&locp->buf[2]);
+        _hxblobfree(locp, &locp->buf[2], ref);
+    }
+
+    LEAVE(locp, ret);
+}
+
 // sync_save: save a buffer that may affect the page
 //  in the persistent hxnext buffer.
 static void
@@ -28,7 +28,7 @@
 void
 _hxinitRefs(HXLOCAL * locp)
 {
-    int     novers = (locp->npages - 1) / HXPGRATE + 1;
+    int     novers = (locp->npages - 1) / locp->file->pgrate + 1;
     int     maxrefs = DATASIZE(locp->file) / MINRECSIZE;
 
     locp->vnext = calloc(locp->npages, sizeof(PAGENO));
@@ -64,8 +64,14 @@ _hxfindHeads(HXLOCAL const *locp, HXBUF const *bufp)
     PAGENO  head, *pp, *zprev = locp->vprev;
     char   *recp, *endp;
 
+    // A blob page has no records, and no heads.
+    if (IS_BLOBPG(locp->file, bufp)) {
+        *zprev = 0;
+        return 0;
+    }
+
     FOR_EACH_REC(recp, bufp, endp) {
-        head = _hxhead(locp, RECHASH(recp));
+        head = _hxhead(locp, RECHASH64(locp->file, recp));
         for (pp = locp->vprev; pp < zprev && *pp != head; ++pp);
         if (pp == zprev)
             *zprev++ = head;
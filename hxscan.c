@@ -0,0 +1,365 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// NAME hxscan: pass every record to a callback.
+//      hxscan_live: the same, locking one chain at a time.
+//      hxscan_from: hxscan_live in slices, from a saved HXCURSOR.
+//      hxscan_part: pass every record of one partition to a callback.
+//
+// RETURNS
+//  >=0   number of records passed to fn.
+//  <0    an error: a HXERR_* enum value.
+//
+// DESCRIPTION
+//  hxscan reads the file in page order, each page once, with one
+//  shared lock and one ENTER/LEAVE for the whole scan. With HX_MMAP,
+//  fn gets pointers straight into the mapping; otherwise pages are
+//  read SCAN_BYTES at a time into one buffer. Map and blob pages
+//  are skipped; a blob is read whole into locp->mem.
+//
+//  hxscan_live does not block writers for the whole scan: it locks
+//  one chain at a time, as hxget does, and passes fn the chain's
+//  records while it is locked. It is not a point-in-time snapshot.
+//  A record that is in the file for the whole scan is passed to fn
+//  exactly once, however the file is split or shrunk meanwhile; a
+//  record added, deleted or replaced during the scan may be passed
+//  in its old form, its new form, or not at all.
+//
+//  hxscan_from continues such a scan from (*cursor), and returns once
+//  it has passed (budget) records and finished the chain it is in,
+//  or fn stops it; it returns 0 when the scan is complete. The cursor
+//  is a position in hash order, not a page, so it stays valid as the
+//  file grows or shrinks between slices, and writers get the file
+//  between slices. If fn stops the scan, the cursor is left at the
+//  start of that chain, and its records are passed again: resuming
+//  passes each record at least once.
+//
+//  A record belongs to partition ((V & (parts-1)) * nparts / parts),
+//  where V is the value whose low bits choose the record's head
+//  (see _hxhead), and (parts) is a power of two at least 16 times
+//  (nparts). Splits move a record to a head with the same low bits,
+//  so the partition does not change as the file grows: partitions
+//  scanned one after another return each unchanged record once.
+//
+//  The file is held with a shared (F_RDLCK) lock, so many partitions
+//  can be scanned at once. fcntl locks belong to a process: threads
+//  that scan with their own handles each drop the process's lock
+//  when they return, so writers in other processes should be kept
+//  out until the last thread is done (or scan from processes).
+//
+// IMPLEMENTATION
+//  hxscan_live visits records in the order of K = BITREV(V), where V
+//  is the value whose low bits choose the record's head. A head whose
+//  records have N significant bits of V holds exactly the records
+//  whose K lies in one interval of size 2**(32-N); a split halves
+//  that interval, and a merge joins two halves. The scan keeps a
+//  cursor (K): it locks the head of K, passes fn the records of the
+//  chain with keys >= K, and moves K to the end of the head's
+//  interval. Keys below K were passed before, in an earlier interval.
+//
+//  hxscan_part walks the chains of the file. Once there are at least
+//  (parts) heads, every record in a chain has the same partition,
+//  and only the partition's own chains are walked; before that, all
+//  chains are walked and records are filtered one by one. A shared
+//  tail page is read once: a chain walk stops at a page already
+//  seen, since the rest of that chain has been seen too.
+//  Records are passed to fn in place, in the page buffer (or the
+//  mapped file); a blob is read whole into locp->mem.
+
+#include <limits.h>
+
+#include "_hx.h"
+
+enum { SCAN_BYTES = 1 << 20 };
+
+static int _owner(unsigned parts, int nparts, PAGENO v);
+static int _scanchain(HXLOCAL *, uint64_t * keyp, HX_SCAN_FN, void *ctx,
+                      int *nrecsp);
+static int _recdata(HXLOCAL *, char const *recp, char const **rpp);
+
+// An HXCURSOR holds the hash-order key (K, below) of the next chain,
+//  LSB-first; K is 2**32 once the scan is done.
+static inline uint64_t
+_getpos(HXCURSOR const *cp)
+{
+    return LDUL(cp->pos) | (uint64_t) LDUL(cp->pos + 4) << 32;
+}
+
+static inline void
+_setpos(HXCURSOR * cp, uint64_t key)
+{
+    STLG((uint32_t) key, cp->pos);
+    STLG((uint32_t) (key >> 32), cp->pos + 4);
+}
+
+static inline uint32_t
+BITREV(uint32_t x)
+{
+    x = (x & 0x55555555) << 1 | (x >> 1 & 0x55555555);
+    x = (x & 0x33333333) << 2 | (x >> 2 & 0x33333333);
+    x = (x & 0x0F0F0F0F) << 4 | (x >> 4 & 0x0F0F0F0F);
+    return bswap_32(x);
+}
+
+//--------------|---------------------------------------------
+int
+hxscan(HXFILE * hp, HX_SCAN_FN fn, void *ctx)
+{
+    HXLOCAL loc, *locp = &loc;
+    HXBUF   buf = { };
+    PAGENO  pg, first = 0, count = 0, chunk;
+    int     nrecs = 0;
+
+    if (!hp || !fn || SCANNING(hp))
+        return HXERR_BAD_REQUEST;
+
+    ENTER(locp, hp, NULL, 0);
+    locp->mode = F_RDLCK;
+    _hxlock(locp, 0, 0);
+    _hxsize(locp);
+    if (IS_MMAP(hp))
+        _hxremap(locp);
+
+    chunk = SCAN_BYTES / hp->pgsize;   // at least 16 pages
+    if (!IS_MMAP(hp))
+        locp->scanbuf = malloc(chunk * hp->pgsize);
+
+    for (pg = 1; pg < locp->npages; ++pg) {
+        char   *recp, *endp;
+        char const *rp;
+
+        if (IS_MMAP(hp)) {
+            buf.page = (HXPAGE *) & hp->mmap[(off_t) pg * hp->pgsize];
+        } else {
+            if (pg >= first + count) {
+                first = pg;
+                count = IMIN(chunk, locp->npages - pg);
+                _hxread(locp, (off_t) pg * hp->pgsize, locp->scanbuf,
+                        count * hp->pgsize);
+            }
+            buf.page = (HXPAGE *) & locp->scanbuf[(pg - first) * hp->pgsize];
+        }
+
+        if (IS_MAP(hp, pg))
+            continue;
+        buf.pgno = pg;
+        buf.used = LDUS(&buf.page->used);
+        buf.recs = LDUS(&buf.page->recs);
+        if (buf.used > DATASIZE(hp))
+            LEAVE(locp, HXERR_BAD_FILE);
+        if (IS_BLOBPG(hp, &buf))
+            continue;
+
+        FOR_EACH_REC(recp, &buf, endp) {
+            int     leng = _recdata(locp, recp, &rp);
+
+            ++nrecs;
+            if (fn(rp, leng, ctx))
+                LEAVE(locp, nrecs);
+        }
+    }
+
+    LEAVE(locp, nrecs);
+}
+
+//--------------|---------------------------------------------
+int
+hxscan_from(HXFILE * hp, HXCURSOR * cursor, int budget, HX_SCAN_FN fn,
+            void *ctx)
+{
+    HXLOCAL loc, *locp = &loc;
+    uint64_t key, next;
+    int     nrecs = 0;
+
+    if (!hp || !cursor || budget < 1 || !fn || SCANNING(hp)
+        || (key = _getpos(cursor)) > (uint64_t) 1 << 32)
+        return HXERR_BAD_REQUEST;
+
+    ENTER(locp, hp, NULL, 1);
+    locp->mode = F_RDLCK;
+    while (key >> 32 == 0 && nrecs < budget) {
+        next = key;
+        if (_scanchain(locp, &next, fn, ctx, &nrecs))
+            break;
+        key = next;
+    }
+
+    _setpos(cursor, key);
+    LEAVE(locp, nrecs);
+}
+
+int
+hxscan_live(HXFILE * hp, HX_SCAN_FN fn, void *ctx)
+{
+    HXCURSOR cursor = { };
+
+    return hxscan_from(hp, &cursor, INT_MAX, fn, ctx);
+}
+
+//--------------|---------------------------------------------
+int
+hxscan_part(HXFILE * hp, int part, int nparts, HX_SCAN_FN fn, void *ctx)
+{
+    HXLOCAL loc, *locp = &loc;
+    HXBUF  *bufp;
+    PAGENO  head, pg;
+    unsigned parts;
+    int     nrecs = 0;
+
+    if (!hp || !fn || nparts < 1 || nparts > HX_MAX_PARTS
+        || part < 0 || part >= nparts || SCANNING(hp))
+        return HXERR_BAD_REQUEST;
+
+    for (parts = 16; parts < 16U * nparts; parts <<= 1) {
+    }
+
+    ENTER(locp, hp, NULL, 1);
+    bufp = &locp->buf[0];
+    locp->mode = F_RDLCK;
+    _hxlock(locp, 0, 0);
+    _hxsize(locp);
+    if (IS_MMAP(hp))
+        _hxremap(locp);
+
+    locp->seen = calloc(locp->npages / 8 + 1, 1);
+
+    for (head = 1; head < locp->npages; ++head) {
+        if (!IS_HEAD(hp, head))
+            continue;
+        if ((locp->mask >> 1) + 1 >= parts
+            && _owner(parts, nparts, _hxf2d(hp, head)) != part)
+            continue;
+
+        for (pg = head; pg; pg = bufp->next) {
+            char   *recp, *endp;
+
+            if (locp->seen[pg / 8] & (1 << pg % 8))
+                break;
+            locp->seen[pg / 8] |= 1 << pg % 8;
+            _hxload(locp, bufp, pg);
+            if (bufp->next
+                && (bufp->next >= locp->npages || IS_HEAD(hp, bufp->next)))
+                LEAVE(locp, HXERR_BAD_FILE);
+
+            FOR_EACH_REC(recp, bufp, endp) {
+                HXHASH64 hash = RECHASH64(hp, recp);
+                char const *rp;
+                int     leng;
+
+                if (_owner(parts, nparts,
+                           REV_HASH(hash >> 32)) != part)
+                    continue;
+
+                leng = _recdata(locp, recp, &rp);
+                ++nrecs;
+                if (fn(rp, leng, ctx))
+                    LEAVE(locp, nrecs);
+            }
+        }
+    }
+
+    LEAVE(locp, nrecs);
+}
+
+// _owner: the partition of a data head, or of a record's V.
+static int
+_owner(unsigned parts, int nparts, PAGENO v)
+{
+    return (uint64_t) (v & (parts - 1)) * nparts / parts;
+}
+
+// _scanchain: lock the head for cursor (*keyp), pass fn the records of
+//  its chain whose keys are >= *keyp, and move *keyp past the head's
+//  interval. Returns nonzero if fn stopped the scan.
+static int
+_scanchain(HXLOCAL * locp, uint64_t * keyp, HX_SCAN_FN fn, void *ctx,
+           int *nrecsp)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *bufp = &locp->buf[0];
+    PAGENO  d, half;
+    int     bits, loops = HX_MAX_CHAIN, stop = 0;
+
+    // A hash whose head is the head of (*keyp).
+    locp->hash = (HXHASH64) REV_HASH(BITREV(*keyp)) << 32;
+    _hxlockset(locp, HEAD_LOCK);
+    if (IS_MMAP(hp))
+        _hxremap(locp);
+
+    // (bits) of V are significant for (d): one fewer if
+    //  d is in the lower half and not yet split.
+    d = _hxf2d(hp, locp->head);
+    half = (locp->mask + 1) / 2;
+    bits = __builtin_popcount(locp->mask);
+    if (d < half && d + half >= locp->dpages)
+        --bits;
+
+    bufp->next = locp->head;
+    do {
+        char   *recp, *endp;
+
+        if (!--loops)
+            LEAVE(locp, HXERR_BAD_FILE);
+        _hxload(locp, bufp, bufp->next);
+
+        FOR_EACH_REC(recp, bufp, endp) {
+            HXHASH64 hash = RECHASH64(hp, recp);
+            char const *rp;
+            int     leng;
+
+            if (_hxhead(locp, hash) != locp->head
+                || BITREV(REV_HASH(hash >> 32)) < *keyp)
+                continue;
+
+            leng = _recdata(locp, recp, &rp);
+            ++*nrecsp;
+            if (fn(rp, leng, ctx)) {
+                stop = 1;
+                break;
+            }
+        }
+    } while (!stop && bufp->next);
+
+    _hxunlock(locp, 0, 0);
+    *keyp = (uint64_t) BITREV(d) + ((uint64_t) 1 << (32 - bits));
+    return stop;
+}
+
+// _recdata: set *rpp to the user data of a record, in place;
+//  a blob is first read whole into locp->mem. Returns its length.
+static int
+_recdata(HXLOCAL * locp, char const *recp, char const **rpp)
+{
+    HXFILE const *hp = locp->file;
+    int     leng;
+
+    if (!IS_BLOB(recp)) {
+        *rpp = RECDATA(recp);
+        return USERLENG(hp, recp);
+    }
+
+    leng = BLOB_REF(hp, recp).leng;
+    if (locp->memsize < leng) {
+        free(locp->membase);
+        locp->membase = locp->mem = malloc(locp->memsize = leng);
+    }
+    _hxblobget(locp, recp, locp->mem, leng);
+    *rpp = locp->mem;
+    return leng;
+}
@@ -44,19 +44,74 @@
 //  frees with _hxalloc(..., 0). There's a more efficient
 //  way to do this (qv hxbuild updating map pages).
 //
-// Compression reduces the size of a hx file, by:
-//  - moving overflow pages into lower (empty) slots
-//  - merging split head pages
-//  - truncating trailing (empty) pages of file.
+// Compression reduces the size of a hx file, by truncating its
+//  last page until the file is small enough. An overflow page (or
+//  blob page) there is moved to a free overflow page, as hxdefrag
+//  moves pages. A head is merged into the chain it was split from:
+//  its records are copied into that chain, its overflow pages
+//  linked into it, and only then is the file truncated. Every copy
+//  is saved before the original is removed, so a crash leaves at
+//  worst duplicates and orphan pages, which hxfix cleans up. This
+//  stops when there is no free overflow page for what the last
+//  page holds, so packing never grows the file.
+//
+// An mmap'd file is reshaped in place: page headers are read
+//  from the mapping, and truncation remaps it.
 //
 // NOTES Merging chains can alter the contents of tail pages,
 //  which means a second hxpack will recover a bit more space
 //  than the first.
+//
+// hxshape_step(hp, x, budget) moves the file towards the same
+//  target a page at a time, locking only what each step touches,
+//  so other processes keep working on the file meanwhile:
+//  - growing is one _hxgrow split, with the split pages and
+//  the end of file locked, as hxput does.
+//  - shrinking trims the last page of the file, when it is a
+//  map, a free overflow page, or a head without overflows whose
+//  records fit in the head it was split from (the reverse of
+//  _hxgrow). Anything harder needs hxshape.
+//  The overflow count is the number of allocated overflow pages
+//  in the bitmaps; a tail shared by several chains counts once.
+//  A file is not shrunk until it is 1/8 larger than the target,
+//  so that steps do not alternate between growing and shrinking.
+//
+// hxautogrow(hp, fill) stores (fill) in the root page's flags.
+//  From then on, hxput keeps a moving average of the bytes in the
+//  chains it walks (an unbiased sample, since keys hash uniformly
+//  over heads), and does one _hxgrow split whenever that is over
+//  (fill) percent of a page. This is controlled linear hashing: the
+//  file splits as its load rises, rather than only when a chain has
+//  no room and there is no free overflow page. The average is per
+//  process; a file shared by many writers is split by each of them.
+//
+// hxautoshrink(hp, low) is the reverse: when that average drops
+//  below (low) percent, hxput (and so hxdel) does one hxshape_step
+//  trim of the last page, with the same locks. A trim that fails
+//  (the last head has overflows, or an overflow page is in use) is
+//  not retried for the next 64 samples. hxdelv and hxpurge sample
+//  the chains they walk, and then trim while the file is locked. The gap between (low) and
+//  (fill) keeps the file from splitting and merging the same head.
 
 #include <assert.h>
 
 #include "_hx.h"
 
+static void _append(HXFILE const *, HXBUF *, char **rpp, char *ep, int used,
+                    int recs);
+static int _blobrelink(HXLOCAL *, HXBUF *, PAGENO last, PAGENO to);
+static PAGENO _fill(HXLOCAL *, HXBUF *, PAGENO lo, PAGENO first,
+                    PAGENO skip, PAGENO tail, int memlen);
+static PAGENO _goodsize(HXLOCAL *, HXBUF *, double overload, PAGENO nblobs);
+static void _memput(HXLOCAL *, char const *rp, int *memlenp);
+static int _mergelast(HXLOCAL *);
+static int _movelast(HXLOCAL *);
+static PAGENO _nalloc(HXLOCAL *, HXBUF *, PAGENO * nmapsp);
+static PAGENO _nblobs(HXLOCAL *);
+static void _steplock(HXLOCAL *);
+static int _trim(HXLOCAL *);
+static int _unsplit(HXLOCAL *);
+
 static int
 cmpused(PGINFO const *a, PGINFO const *b)
 {
@@ -68,29 +123,28 @@ HXRET
 hxshape(HXFILE * hp, double overload)
 {
     HXLOCAL loc, *locp = &loc;
-    HXBUF  *srcp, *dstp, *oldp;
-    int     pos, bitpos;
+    HXBUF  *srcp, *dstp;
     PGINFO *atail, *ztail;
-    PAGENO  pg, pm, *aprev, *afree, *zfree;
+    PAGENO  pg, pm, *aprev;
     double  totbytes = 0, fullbytes = 0, fullpages = 0;
 
-    if (!hp || hp->buffer.pgno || hp->mode & HX_MMAP
-        || !(hp->mode & HX_UPDATE))
+    if (!hp || hp->buffer.pgno || !(hp->mode & HX_UPDATE))
         return HXERR_BAD_REQUEST;
 
     ENTER(locp, hp, NULL, 3);
 
     _hxlock(locp, 0, 0);
     _hxsize(locp);
+    if (IS_MMAP(hp))
+        _hxremap(locp);
 
     srcp = &locp->buf[0];
     dstp = &locp->buf[1];
-    oldp = &locp->buf[2];
 
     _hxinitRefs(locp);
 
     // Populate vnext,vrefs,vtail for tail-merging:
-    ztail = calloc(locp->npages / HXPGRATE + 1, sizeof(PGINFO));
+    ztail = calloc(locp->npages / hp->pgrate + 1, sizeof(PGINFO));
     locp->vtail = ztail;
 
     for (pg = 1; pg < locp->npages; ++pg) {
@@ -100,7 +154,7 @@ hxshape(HXFILE * hp, double overload)
         totbytes += x.used;
         if (x.pgno)             // i.e. page.next != 0
             ++fullpages, fullbytes += x.used;
-        else if (x.used && !IS_HEAD(pg))
+        else if (x.recs && !IS_HEAD(hp, pg))
             x.pgno = pg, *ztail++ = x;
     }
 
@@ -135,10 +189,15 @@ hxshape(HXFILE * hp, double overload)
             PUTLINK(locp, *aprev, dstp->pgno);
 
         ztail->used += srcp->used;
+        ztail->recs += srcp->recs;
         srcp->used = srcp->recs = 0;
+        STAIN(srcp);
         BUFLINK(locp, srcp, 0);
         _hxsave(locp, srcp);
         _hxalloc(locp, srcp->pgno, 0);
+        // As in _hxputfreed: an empty page is no tail to share.
+        if (hp->tail.pgno == srcp->pgno)
+            hp->tail.used = DATASIZE(hp);
         ++atail;
     }
 
@@ -147,7 +206,7 @@ hxshape(HXFILE * hp, double overload)
     PAGENO  overflows = 0;
 
     for (pg = 1; pg < locp->npages; ++pg) {
-        if (IS_HEAD(pg)) {
+        if (IS_HEAD(hp, pg)) {
             int     loops = HX_MAX_CHAIN;
 
             for (pm = pg; (pm = locp->vnext[pm]); ++overflows)
@@ -161,9 +220,9 @@ hxshape(HXFILE * hp, double overload)
 
     DEBUG("%.0f/%.0f=%0.f  %.0f %lu/%.2f=%lu => %lu",
           fullbytes, fullpages, fullbytes / fullpages,
-          totbytes, dpages, overload + 1, goodsize, _hxd2f(goodsize));
+          totbytes, dpages, overload + 1, goodsize, _hxd2f(hp, goodsize));
     // "+1" for the root page
-    goodsize = goodsize ? _hxd2f(goodsize) + 1 : 2;
+    goodsize = goodsize ? _hxd2f(hp, goodsize) + 1 : 2;
     if (locp->npages <= goodsize) {
         // Increase dpages.
         // Note that _hxgrow always returns an ALLOCATED
@@ -181,189 +240,622 @@ hxshape(HXFILE * hp, double overload)
         _hxflushfreed(locp, dstp);
         LEAVE(locp, HXNOTE);
     }
-    // Build a list of free pgnos
-    assert(sizeof *afree <= sizeof *locp->vtail);
-    afree = zfree = (PAGENO *) locp->vtail;
+    // Shrink from the end of file.
+    while (locp->npages > goodsize && _unsplit(locp)) {
+    }
+
+    LEAVE(locp, HXOKAY);
+}
+
+//--------------|---------------------------------------------
+HXRET
+hxshape_step(HXFILE * hp, double overload, int budget)
+{
+    HXLOCAL loc, *locp = &loc;
+    HXBUF  *bufp;
+    PAGENO  before, nblobs = 0;
+    int     moved = 0, dir = 0;
+
+    if (!hp || hp->buffer.pgno || hp->hold || overload < 0
+        || budget < 0 || !(hp->mode & HX_UPDATE))
+        return HXERR_BAD_REQUEST;
+
+    ENTER(locp, hp, NULL, 3);
+    bufp = &locp->buf[1];
 
-    for (pg = pm = 0; pg < locp->npages; pg += HXPGRATE) {
-        if (!VREF(locp, pg) && !IS_MAP(hp, pg))
-            *zfree++ = pg;
+    _hxsize(locp);
+    while (moved < budget) {
+        _steplock(locp);
+        if (IS_MMAP(hp))
+            _hxremap(locp);
+        before = locp->npages;
+        // Steps neither add nor free blob pages; count them once.
+        if (!dir && HAS_BLOBS(hp))
+            nblobs = _nblobs(locp);
+
+        PAGENO  goodsize = _goodsize(locp, bufp, overload, nblobs);
+
+        DEBUG2("npages=%u goodsize=%u", locp->npages, goodsize);
+        if (dir >= 0 && locp->npages < goodsize) {
+            PAGENO  junk = 0;
+
+            _hxgrow(locp, bufp, 0, &junk);
+            _hxsave(locp, bufp);
+            _hxalloc(locp, bufp->pgno, 0);
+            _hxflushfreed(locp, bufp);
+            dir = 1;
+        } else if (dir <= 0 && locp->npages > goodsize + goodsize / 8
+                   && _trim(locp)) {
+            dir = -1;
+        } else {
+            break;
+        }
+
+        // Other processes may resize the file between steps.
+        moved += dir * (int)(locp->npages - before);
+        _hxunlock(locp, 0, 0);
     }
 
-    // Since we are decrementing npages BEFORE reading last page,
-    //  set locked such that _hxislocked gives correct answer.
-    hp->locked |= LOCKED_BEYOND;
-    // Work backward from end of file, trimming pages.
-    for (; locp->npages > goodsize; --locp->npages) {
+    LEAVE(locp, moved);
+}
+
+//--------------|---------------------------------------------
+HXRET
+hxautogrow(HXFILE * hp, int fill)
+{
+    HXLOCAL loc, *locp = &loc;
+
+    if (!hp || fill < 0 || fill > 127 || !(hp->mode & HX_UPDATE)
+        || hp->hold)
+        return HXERR_BAD_REQUEST;
 
-        PAGENO  srchead = locp->npages - 1;
-        PAGENO  srctail, dsthead, dstneck, dsttail;
-        int     loops = HX_MAX_CHAIN;
+    ENTER(locp, hp, NULL, 1);
+    _hxlock(locp, 0, 1);
+    if (fill && fill <= SHRINK_FLOOR(hp))
+        LEAVE(locp, HXERR_BAD_REQUEST);
+    _hxsetflags(locp, (hp->flags & ~ROOT_GROW) | fill << 9);
+    LEAVE(locp, HXOKAY);
+}
 
-        // EASIEST CASE: a map or unreferenced oveflow page
-        if (srchead == zfree[-1] || IS_MAP(hp, srchead)) {
-            assert(!VREF(locp, srchead) && !IS_HEAD(srchead));
-            --zfree;
-            continue;
+//--------------|---------------------------------------------
+HXRET
+hxautoshrink(HXFILE * hp, int low)
+{
+    HXLOCAL loc, *locp = &loc;
+
+    if (!hp || low < 0 || low > 63 || !(hp->mode & HX_UPDATE)
+        || hp->hold)
+        return HXERR_BAD_REQUEST;
+
+    ENTER(locp, hp, NULL, 1);
+    _hxlock(locp, 0, 1);
+    if (low && GROW_FILL(hp) && low >= GROW_FILL(hp))
+        LEAVE(locp, HXERR_BAD_REQUEST);
+    _hxsetflags(locp, (hp->flags & ~ROOT_SHRINK) | low << 3);
+    LEAVE(locp, HXOKAY);
+}
+
+// _hxautoshape: fold the bytes of a chain that hxput walked into
+//  hp->chainload; then do one _hxgrow split if that is over the
+//  file's fill percent, or one _hxautotrim if it is under the
+//  floor. A split lowers the average chain load by one part in
+//  (dpages). hxput's own record is already saved, so its locks can
+//  be dropped, then the pages locked in the same order as hxput's
+//  own _hxgrow: splits, end of file, then maps.
+void
+_hxautoshape(HXLOCAL * locp, double chainbytes)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *bufp = &locp->buf[1];
+    PAGENO  junk = 0;
+
+    if (!(hp->flags & (ROOT_GROW | ROOT_SHRINK)) || hp->hold
+        || SCANNING(hp))
+        return;
+
+    _hxsample(hp, chainbytes);
+    if (GROW_FILL(hp)
+        && hp->chainload * 100 > GROW_FILL(hp) * DATASIZE(hp)) {
+
+        // hxput may hold map pages; split pages must be locked first.
+        _hxunlock(locp, 0, 0);
+        _hxlockset(locp, BOTH_LOCK);
+        if (IS_MMAP(hp))
+            _hxremap(locp);
+
+        DEBUG2("npages=%u chainload=%.0f", locp->npages, hp->chainload);
+        _hxlock(locp, locp->npages, 0);
+        _hxgrow(locp, bufp, 0, &junk);
+        _hxsave(locp, bufp);
+        _hxalloc(locp, bufp->pgno, 0);
+        _hxflushfreed(locp, bufp);
+        hp->chainload -= hp->chainload / locp->dpages;
+
+    } else if (hp->chainload * 100 < SHRINK_FLOOR(hp) * DATASIZE(hp)) {
+
+        // The last page may be one _trim cannot remove (a head with
+        //  overflows); do not lock for it on every call.
+        if (hp->shrinkwait) {
+            --hp->shrinkwait;
+            return;
         }
-        // EASIER CASE: an empty head page
-        _hxload(locp, srcp, srchead);
-        if (!srcp->used)
-            continue;
 
-        // Anything from here on might need 2 free pages
-        if (zfree - afree < 2)
-            break;
+        _hxunlock(locp, 0, 0);
+        _steplock(locp);
+        if (IS_MMAP(hp))
+            _hxremap(locp);
+        if (!_hxautotrim(locp))
+            hp->shrinkwait = 64;
+    }
+}
 
-        --VREF(locp, srcp->next);
+// _hxautotrim: trim the last page of the file, as hxshape_step
+//  does, if hp->chainload is under the file's floor percent. The
+//  caller holds the pages _steplock would, or the whole file.
+//  Removing a head raises the average chain load by one part in
+//  (dpages). Returns 1 if a page was removed.
+int
+_hxautotrim(HXLOCAL * locp)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  last = locp->npages - 1;
 
-        STAIN(srcp);
-        srcp->pgno = *afree++;
-#   if 0
-        // hxshape does not work with MMAP as yet.
-        if (hp->mmap)
-            memcpy(&hp->mmap[(off_t) srcp->pgno * hp->pgsize],
-                   srcp->page, hp->pgsize);
-#   endif
-        _hxalloc(locp, srcp->pgno, 1);
-        _hxsetRef(locp, srcp->pgno, srcp->next);
+    if (hp->chainload * 100 >= SHRINK_FLOOR(hp) * DATASIZE(hp)
+        || locp->npages <= 2 || !_trim(locp))
+        return 0;
+
+    DEBUG2("npages=%u chainload=%.0f", locp->npages, hp->chainload);
+    if (IS_HEAD(hp, last))
+        hp->chainload += hp->chainload / locp->dpages;
+    return 1;
+}
+
+// _goodsize: the file size (npages) that hxshape would aim for,
+//  counting allocated overflow pages in the bitmaps, less the
+//  (nblobs) of them that are blob pages. Growing the file does
+//  not shorten blob lists, so counting them would grow it forever.
+static PAGENO
+_goodsize(HXLOCAL * locp, HXBUF * bufp, double overload, PAGENO nblobs)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  nmaps, overflows = _nalloc(locp, bufp, &nmaps);
 
-        // EASY CASE: an overflow page to relocate:
-        if (!IS_HEAD(srchead)) {
+    overflows = overflows > nblobs ? overflows - nblobs : 0;
+    PAGENO  goodsize = (locp->dpages + overflows) / (1.0 + overload);
 
-            _hxsave(locp, srcp);
-            _hxfindRefs(locp, srcp, srchead);
+    // Unlike hxshape, no "+1": _hxd2f counts the root page,
+    //  and a file with no overflows must be in shape.
+    return goodsize ? _hxd2f(hp, goodsize) : 2;
+}
 
-            for (aprev = locp->vprev; *aprev; ++aprev)
-                PUTLINK(locp, *aprev, srcp->pgno);
+// _nalloc: the number of allocated overflow pages in the bitmaps,
+//  and the number of map pages. Every map page marks itself as
+//  allocated. Blob pages are counted too.
+static PAGENO
+_nalloc(HXLOCAL * locp, HXBUF * bufp, PAGENO * nmapsp)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  mpg = 0, overflows = 0;
+    int     pos;
+
+    *nmapsp = 0;
+    do {
+        int     waslocked = _hxislocked(locp, mpg);
+
+        _hxload(locp, bufp, mpg);
+        for (pos = mpg ? 0 : hp->uleng; pos < (int)DATASIZE(hp); ++pos)
+            overflows += __builtin_popcount((BYTE) bufp->data[pos]);
+        --overflows;
+        ++*nmapsp;
+        if (!waslocked)
+            _hxunlock(locp, mpg, 1);
+    } while ((mpg = NEXT_MAP(hp, mpg)) < locp->npages);
+
+    return overflows;
+}
 
+// _nblobs: the number of blob pages, from the page headers of
+//  overflow pages.
+static PAGENO
+_nblobs(HXLOCAL * locp)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  pg, nblobs = 0;
+
+    for (pg = hp->pgrate; pg < locp->npages; pg += hp->pgrate) {
+        if (IS_MAP(hp, pg))
             continue;
+
+        PGINFO  x = _hxpginfo(locp, pg);
+
+        nblobs += x.used && !x.recs;
+    }
+
+    return nblobs;
+}
+
+// _steplock: lock the pages that one step may change: the
+//  split pages for the next _hxgrow, the last page and the head
+//  it would merge into, and everything beyond the end of file.
+//  Pages are locked in descending order, as _hxlockset does.
+//  Holding the split pages stops any other process changing the
+//  file size; if it changed before they were locked, start over.
+static void
+_steplock(HXLOCAL * locp)
+{
+    HXFILE *hp = locp->file;
+
+    while (1) {
+        _hxsize(locp);
+
+        PAGENO  npages = locp->npages, last = npages - 1;
+        PAGENO  pgv[2 * HXPGRATE_MAX + 3] = { }, *pp = pgv;
+        int     ct;
+
+        if ((int)npages < hp->pgrate * 2) {
+            _hxlock(locp, 0, 0);
+            _hxsize(locp);
+            return;
         }
-        // HARD CASE: a head page to desplit:
-        locp->hash = RECHASH(srcp->data);
-        _hxpoint(locp);         // recalc (dpages,head)
 
-        dsthead = locp->head;
-        dstneck = locp->vnext[dsthead];
-        dsttail = _hxgetRef(locp, dsthead, 0);
-        srctail = _hxgetRef(locp, srchead, 0);
+        if (IS_HEAD(hp, last))
+            *pp++ = last, *pp++ = SPLIT_LO(hp, last);
+        _hxsplits(hp, pgv, npages);
 
-        // Append srchead to dsttail, or insert chain between
-        // dsthead and vnext[dsthead]. If srctail is shared,
-        // make a copy of * it first.
-        if (dsttail == dsthead || VREF(locp, dsttail) == 1) {
+        for (pp = pgv; *pp; pp += ct) {
+            for (ct = 1; pp[ct] && pp[ct] + ct == *pp; ++ct);
+            _hxlock(locp, *pp - ct + 1, ct);
+        }
 
-            dsthead = dsttail;
+        // Nothing grows the file without holding its split pages.
+        //  Check the size before waiting on (beyond): if it grew,
+        //  hxput may hold a new head there while waiting for a split.
+        _hxsize(locp);
+        if (locp->npages == npages) {
+            _hxlock(locp, npages, 0);
+            return;
+        }
+        _hxunlock(locp, 0, 0);
+    }
+}
 
-        } else if (srctail == srchead) {
+// _trim: remove the last page of the file, if that is simple.
+static int
+_trim(HXLOCAL * locp)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *srcp = &locp->buf[0], *dstp = &locp->buf[1];
+    PAGENO  last = locp->npages - 1;
+    int     bitpos;
 
-            BUFLINK(locp, srcp, dstneck);
+    if (IS_MAP(hp, last)) {
+        // It maps no page but itself.
+        _hxlock(locp, last, 1);
 
-        } else if (VREF(locp, srctail) == 1) {
+    } else if (!IS_HEAD(hp, last)) {
 
-            PUTLINK(locp, srctail, dstneck);
+        // A process freeing (last) holds it until the page is saved.
+        _hxlock(locp, last, 1);
+        _hxload(locp, srcp, _hxmap(hp, last, &bitpos));
+        if (srcp->data[bitpos >> 3] & (1 << (bitpos & 7)))
+            return 0;
 
-        } else if (srctail == dsttail) {
+    } else {
 
-            if (dsttail != dstneck) {
+        _hxload(locp, srcp, last);
+        if (srcp->next)
+            return 0;
 
-                srctail = _hxgetRef(locp, srcp->pgno, srctail);
+        if (srcp->used) {
+            _hxload(locp, dstp, SPLIT_LO(hp, last));
+            if (!_FITS(hp, dstp->used, dstp->recs, srcp->used, srcp->recs))
+                return 0;
 
-                if (srctail == srcp->pgno) {
+            _hxappend(dstp, srcp->data, srcp->used);
+            dstp->recs += srcp->recs;
+            _hxsave(locp, dstp);
+        }
+    }
 
-                    BUFLINK(locp, srcp, dstneck);
+    DEBUG2("trim pgno=%u", last);
+    _hxresize(locp, last);
+    return 1;
+}
 
-                } else {
+// _unsplit: remove the last page of the file, when _trim cannot.
+//  Every copy is saved before the page or record it copies is
+//  removed, so a crash leaves duplicates or orphan pages for hxfix,
+//  never missing records. Returns 0 if there is no room below the
+//  last page for what it holds.
+static int
+_unsplit(HXLOCAL * locp)
+{
+    if (_trim(locp))
+        return 1;
 
-                    PUTLINK(locp, srctail, dstneck);
-                }
-            }
+    return IS_HEAD(locp->file, locp->npages - 1)
+        ? _mergelast(locp) : _movelast(locp);
+}
 
-        } else {
+// _movelast: move the last page, an overflow or blob page, to the
+//  first free overflow page, as hxdefrag moves pages: the copy is
+//  saved, the pages (or blob stub) that link to it are relinked,
+//  then it is freed and the file truncated.
+static int
+_movelast(HXLOCAL * locp)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *currp = &locp->buf[0], *newp = &locp->buf[1];
+    PAGENO  last = locp->npages - 1, to, *aprev;
+
+    if (!_hxfindnear(locp, newp, 0, last))
+        return 0;
+
+    to = newp->pgno;
+    SCRUB(newp);
+    _hxload(locp, currp, last);
+    _hxmove(locp, currp, to);
+    _hxsave(locp, currp);
+    _hxsetRef(locp, to, currp->next);
+
+    if (IS_BLOBPG(hp, currp)) {
+        if (!_blobrelink(locp, newp, last, to))
+            LEAVE(locp, HXERR_BAD_FILE);
+    } else {
+        _hxfindRefs(locp, currp, last);
+        for (aprev = locp->vprev; *aprev; ++aprev)
+            PUTLINK(locp, *aprev, to);
+    }
+
+    DEBUG2("move pgno=%u to=%u", last, to);
+    _hxsetRef(locp, last, 0);
+    _hxalloc(locp, last, 0);
+    _hxresize(locp, last);
+    return 1;
+}
 
-            _hxload(locp, oldp, srctail);
-            if (!oldp->used)
+// _mergelast: merge the last page, a head, into the chain it was
+//  split from (lo), the reverse of _hxgrow. Its records, including
+//  those in a tail it shares with other chains, are copied into
+//  lo's chain (see _fill); then the file is truncated, its own
+//  overflow pages freed, and the old copies in the shared tail
+//  deleted. If there is no room to copy the records in its own
+//  overflow pages, those pages are linked into lo's chain as they
+//  are. Returns 0, having changed nothing, if the copies need more
+//  free overflow pages than there are.
+static int
+_mergelast(HXLOCAL * locp)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *bufp = &locp->buf[0];
+    PAGENO  last = locp->npages - 1, lo = SPLIT_LO(hp, last);
+    PAGENO  pg, next, first = 0, owned = 0, shared = 0, keep = 0;
+    PAGENO  dlast = _hxf2d(hp, last), mask = locp->mask, nmaps, nfree;
+    int     memlen = 0, headlen, loops = HX_MAX_CHAIN, mine;
+    char   *rp, *ep;
+
+    // Pages after the head that hold only its records come first;
+    //  a page that also holds records of other chains is a tail.
+    for (pg = last; pg; pg = bufp->next) {
+        if (!--loops)
+            LEAVE(locp, HXERR_BAD_FILE);
+
+        _hxload(locp, bufp, pg);
+        mine = 0;
+        FOR_EACH_REC(rp, bufp, ep)
+            mine += _hxhead(locp, RECHASH64(hp, rp)) == last;
+
+        if (pg != last && mine == bufp->recs) {
+            if (!first)
+                first = pg;
+            owned = pg;
+            continue;
+        }
+
+        if (pg != last) {
+            if (bufp->next)
                 LEAVE(locp, HXERR_BAD_FILE);
+            shared = pg;
+        }
 
-            _hxfresh(locp, dstp, *afree++);
-            _hxalloc(locp, dstp->pgno, 1);
-            _hxshift(locp, locp->head, srchead, oldp, dstp, dstp);
-            _hxsave(locp, oldp);
-            // This hack prevents the CHECK in _hxlink from
-            // aborting when oldp contains a page that the
-            // next iteration wants to PUTLINK. This ONLY occurs
-            // in this code (I think).
-            // TODO: can this happen in (hxfix,hxshape)??
-            oldp->pgno = -1;
-
-            BUFLINK(locp, dstp, dstneck);
-            _hxsave(locp, dstp);
+        FOR_EACH_REC(rp, bufp, ep)
+            if (_hxhead(locp, RECHASH64(hp, rp)) == last)
+            _memput(locp, rp, &memlen);
+    }
 
-            if (srcp->next == srctail) {
+    headlen = memlen;
+    for (pg = first; pg && pg != shared; pg = locp->vnext[pg]) {
+        _hxload(locp, bufp, pg);
+        FOR_EACH_REC(rp, bufp, ep)
+            _memput(locp, rp, &memlen);
+    }
 
-                BUFLINK(locp, srcp, dstp->pgno);
+    // As in hxput, a head with no overflow pages may share the
+    //  tail page that _hxsave last found room in.
+    PAGENO  tail = hp->tail.pgno;
 
-            } else {
+    if (locp->vnext[lo] || !tail || tail >= last || tail == owned
+        || tail == shared || IS_HEAD(hp, tail) || IS_MAP(hp, tail))
+        tail = 0;
+    else if (_hxpginfo(locp, tail).pgno || !_hxpginfo(locp, tail).recs)
+        tail = 0;
 
-                pg = _hxgetRef(locp, srchead, srctail);
-                PUTLINK(locp, pg, dstp->pgno);
-            }
+    PAGENO  nalloc = _nalloc(locp, bufp, &nmaps);
+
+    nfree = (last - 1) / hp->pgrate + 1 - nmaps - nalloc;
+    if (_fill(locp, NULL, lo, 0, shared, tail, memlen) > nfree) {
+        keep = first, memlen = headlen;
+        if (!keep || _fill(locp, NULL, lo, keep, shared, tail, memlen) > nfree)
+            return 0;
+    }
+
+    DEBUG2("merge pgno=%u into=%u bytes=%d owned=%u..%u%s shared=%u tail=%u",
+           last, lo, memlen, first, owned, keep ? " kept" : "", shared, tail);
+    _fill(locp, bufp, lo, keep, shared, tail, memlen);
+    if (keep) {
+        if (locp->vnext[owned] != locp->vnext[lo])
+            PUTLINK(locp, owned, locp->vnext[lo]);
+        PUTLINK(locp, lo, first);
+    }
+
+    _hxsetRef(locp, last, 0);
+    _hxresize(locp, last);
+
+    // The head is gone: its own overflow pages are orphans, and
+    //  records in (shared) that hashed to it are copies.
+    for (pg = keep ? 0 : first; pg && pg != shared; pg = next) {
+        next = locp->vnext[pg];
+        _hxsetRef(locp, pg, 0);
+        _hxalloc(locp, pg, 0);
+        _hxfresh(locp, bufp, pg);
+        _hxsave(locp, bufp);
+    }
+
+    if (shared) {
+        _hxload(locp, bufp, shared);
+        for (rp = bufp->data; rp < bufp->data + bufp->used;) {
+            if ((REV_HASH(RECHASH64(hp, rp) >> 32) & mask) == dlast)
+                _hxdelrec(locp, bufp, rp - bufp->data);
+            else
+                rp += RECSIZE(rp);
         }
+        _hxsave(locp, bufp);
+    }
 
-        _hxload(locp, dstp, dsthead);
-        BUFLINK(locp, dstp, srcp->pgno);
+    return 1;
+}
 
-        // Cannot early-out on !SHRUNK here (as "hxput" does);
-        //  new chain may have vacancies in two places.
-        while (1) {
+// _fill: append the (memlen) bytes of records in locp->mem to the
+//  chain at (lo), to the chain from (first) that is about to be
+//  linked into it, but not to their tail page (skip), and then to
+//  page (tail), which (lo) then links to. Only free space is used,
+//  until the rest go in free overflow pages linked after (lo), as
+//  hxput adds them. Returns the number of overflow pages added.
+//  With (bufp) NULL, only counts them.
+static PAGENO
+_fill(HXLOCAL * locp, HXBUF * bufp, PAGENO lo, PAGENO first, PAGENO skip,
+      PAGENO tail, int memlen)
+{
+    HXFILE *hp = locp->file;
+    char   *rp = locp->mem, *ep = locp->mem + memlen;
+    PAGENO  pg, added = 0, startv[] = { lo, first, tail };
+    int     i, loops;
+
+    for (i = 0; i < 3; ++i) {
+        loops = HX_MAX_CHAIN;
+        for (pg = startv[i]; pg && pg != skip && rp < ep;
+             pg = locp->vnext[pg]) {
+            PGINFO  x = _hxpginfo(locp, pg);
 
             if (!--loops)
                 LEAVE(locp, HXERR_BAD_FILE);
+            if (!_FITS(hp, x.used, x.recs, RECSIZE(rp), 1))
+                continue;
+
+            if (bufp)
+                _hxload(locp, bufp, pg);
+            _append(hp, bufp, &rp, ep, x.used, x.recs);
+            if (bufp) {
+                _hxsave(locp, bufp);
+                if (pg == tail)
+                    PUTLINK(locp, lo, tail);
+            }
+        }
+    }
 
-            if (_hxshift(locp, locp->head, srchead, srcp, dstp, dstp)) {
+    for (; rp < ep; ++added) {
+        if (bufp && !_hxfindnear(locp, bufp, 0, locp->npages - 1))
+            LEAVE(locp, HXERR_BAD_FILE);
 
-                SWAP(srcp, dstp);
+        _append(hp, bufp, &rp, ep, 0, 0);
+        if (bufp) {
+            BUFLINK(locp, bufp, locp->vnext[lo]);
+            _hxsave(locp, bufp);
+            PUTLINK(locp, lo, bufp->pgno);
+        }
+    }
 
-            } else {
+    return added;
+}
 
-                BUFLINK(locp, dstp, srcp->next);
+// _append: append records from (*rpp) up to (ep) to a page of
+//  (used) bytes in (recs) records, while they fit, advancing
+//  (*rpp). With (bufp) NULL, nothing is appended.
+static void
+_append(HXFILE const *hp, HXBUF * bufp, char **rpp, char *ep, int used,
+        int recs)
+{
+    char   *rp = *rpp;
 
-                if (!srcp->used != !VREF(locp, srcp->pgno))
-                    LEAVE(locp, HXERR_BAD_FILE);
+    for (; rp < ep && _FITS(hp, used, recs, RECSIZE(rp), 1); ++recs) {
+        used += RECSIZE(rp);
+        if (bufp) {
+            _hxappend(bufp, rp, RECSIZE(rp));
+            ++bufp->recs;
+        }
+        rp += RECSIZE(rp);
+    }
 
-                if (!srcp->used) {
-                    BUFLINK(locp, srcp, 0);
-                    *--afree = srcp->pgno;
-                    _hxalloc(locp, srcp->pgno, 0);
-                }
-            }
+    *rpp = rp;
+}
 
-            _hxsave(locp, srcp);
-            if (!dstp->next)
-                break;
+// _blobrelink: relink what links to blob page (last), the stub
+//  of its blob or the blob page before it, to (to). Returns 0
+//  if nothing does.
+static int
+_blobrelink(HXLOCAL * locp, HXBUF * bufp, PAGENO last, PAGENO to)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  pg, bpg, next;
+    char   *rp, *ep;
 
-            _hxload(locp, srcp, dstp->next);
-        }
+    for (pg = 1; pg < last; ++pg) {
+        if (IS_MAP(hp, pg))
+            continue;
+        _hxload(locp, bufp, pg);
+        if (!bufp->recs)
+            continue;
 
-        _hxsave(locp, dstp);
+        FOR_EACH_REC(rp, bufp, ep) {
+            if (!IS_BLOB(rp))
+                continue;
+
+            BLOBREF ref = BLOB_REF(hp, rp);
+            int     loops = ref.leng / BLOB_DATA(hp) + 2;
+
+            if (ref.first == last) {
+                STLG(to, rp + sizeof(HXREC) + USERLENG(hp, rp)
+                     - sizeof(BLOBREF));
+                SPOT(bufp);
+                _hxsave(locp, bufp);
+                return 1;
+            }
+
+            for (bpg = ref.first; bpg && bpg < last && --loops; bpg = next) {
+                next = _hxpginfo(locp, bpg).pgno;
+                if (next == last) {
+                    PUTLINK(locp, bpg, to);
+                    return 1;
+                }
+            }
+        }
     }
 
-    // npages was overdecremented by one in loop
-    _hxresize(locp, locp->npages + 1);
+    return 0;
+}
 
-    // Zero the freemap for all truncated overflow pages:
-    pg = _hxmap(hp, locp->npages + HXPGRATE
-                - locp->npages % HXPGRATE, &bitpos);
+static void
+_memput(HXLOCAL * locp, char const *rp, int *memlenp)
+{
+    int     size = RECSIZE(rp);
 
-    _hxload(locp, dstp, pg);
-    DEBUG2("clear map %lu from bit %d onward", pg, bitpos);
-    pos = bitpos >> 3;
-    dstp->data[pos++] &= ~(-1 << (bitpos & 7));
-    memset(dstp->data + pos, 0, DATASIZE(hp) - pos);
-    STAIN(dstp);
-    _hxsave(locp, dstp);
+    if (*memlenp + size > locp->memsize) {
+        locp->memsize = 2 * locp->memsize + DATASIZE(locp->file);
+        locp->membase = locp->mem = realloc(locp->mem, locp->memsize);
+    }
 
-    LEAVE(locp, HXOKAY);
+    memcpy(locp->mem + *memlenp, rp, size);
+    *memlenp += size;
 }
 
 //EOF
@@ -17,8 +17,9 @@
 //
 //  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
 //-------------------------------------------------------------------------------
-// hxstat: show chain length distribution
-//  and tail share distribution.
+// hxstat: show chain length distribution,
+//  tail share distribution and chain locality.
+//  Blob pages are counted apart from overflow pages.
 
 #include "_hx.h"
 
@@ -27,7 +28,7 @@ hxstat(HXFILE * hp, HXSTAT * sp)
 {
     HXLOCAL loc, *locp = &loc;
     PAGENO  pg;
-    int     i, nchains;
+    int     i, nchains, nlinks = 0;
 
     if (!hp || !sp)
         return HXERR_BAD_REQUEST;
@@ -52,7 +53,13 @@ hxstat(HXFILE * hp, HXSTAT * sp)
 
         _hxsetRef(locp, pg, bufp->next);
 
-        if (IS_HEAD(bufp->pgno)) {
+        if (IS_BLOBPG(hp, bufp)) {
+            ++sp->blob_pages;
+            sp->blob_bytes += bufp->used;
+            continue;
+        }
+
+        if (IS_HEAD(hp, bufp->pgno)) {
             sp->head_bytes += bufp->used;
         } else if (bufp->used) {
             ++sp->ovfl_pages;
@@ -63,10 +70,11 @@ hxstat(HXFILE * hp, HXSTAT * sp)
 
         FOR_EACH_REC(recp, bufp, endp) {
             ++sp->nrecs;
+            sp->blob_recs += ! !IS_BLOB(recp);
             sp->hash ^= RECHASH(recp);
         }
 
-        if (!IS_HEAD(pg)) {
+        if (!IS_HEAD(hp, pg)) {
             COUNT   nheads = 0;
 
             _hxfindHeads(locp, bufp);
@@ -79,14 +87,18 @@ hxstat(HXFILE * hp, HXSTAT * sp)
     }
 
     for (pg = 1; pg < (unsigned)locp->npages; ++pg) {
-        if (IS_HEAD(pg)) {
-            unsigned j = pg, count = 0;
+        if (IS_HEAD(hp, pg)) {
+            unsigned j = pg, k, count = 0;
 
-            while ((j = locp->vnext[j])
-                   && count < HX_MAX_CHAIN + 1)
+            while ((j = locp->vnext[k = j])
+                   && count < HX_MAX_CHAIN + 1) {
                 ++count;
+                sp->avg_link_dist += j > k ? j - k : k - j;
+                sp->back_links += j < k;
+            }
 
             ++sp->chain_hist[count];
+            nlinks += count;
         }
     }
 
@@ -96,9 +108,13 @@ hxstat(HXFILE * hp, HXSTAT * sp)
             * (int)((i + 2) / 2);
     }
 
-    nchains = locp->npages * (HXPGRATE - 1) / HXPGRATE;
+    nchains = locp->npages * (hp->pgrate - 1) / hp->pgrate;
     sp->avg_fail_pages /= nchains;
     sp->avg_succ_pages /= nchains;
+    if (nlinks) {
+        sp->avg_link_dist /= nlinks;
+        sp->back_links /= nlinks;
+    }
 
     LEAVE(locp, HXOKAY);
 }
@@ -21,13 +21,49 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>             // offsetof
 #include <stdint.h>             // uintptr_t
 #include <stdarg.h>
 
 #include "_hx.h"
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
 
+static int _freebit(BYTE const *, int nbytes, int bit);
+static void _putslot(HXLOCAL const *, HXBUF *, HXHASH, COUNT);
+static void _respace(HXLOCAL const *, HXBUF *, int pos, int oldsize,
+                     int newsize, HXHASH);
+static void _rhslot(COUNT * hind, BYTE * fing, int hsize, unsigned mask,
+                    char const *recs, HXHASH, COUNT pos);
+static PAGENO _scanfree(HXLOCAL *, HXBUF *, PAGENO from, PAGENO below);
+static void _shiftpos(COUNT *, int, int pos, int delta);
+static void _spare(HXLOCAL *, HXBUF *);
+static int _splithead(HXLOCAL *, PAGENO newpg, PAGENO *head, int sized);
+static int _takerun(HXLOCAL const *, HXBUF *, int);
+static int _takeslot(HXLOCAL const *, HXBUF *, int);
 static void _write(HXLOCAL *, off_t, void *, int);
 
+// _hxaddrec: append a record, keeping hind[] current.
+//  (leng) is the length of the user data; see HASH_TAIL.
+//  It may include REC_BLOB, for a blob stub.
+void
+_hxaddrec(HXLOCAL const *locp, HXBUF * bufp, HXHASH64 hash,
+          char const *recdata, COUNT leng)
+{
+    char   *recp = bufp->data + bufp->used;
+    int     tail = HASH_TAIL(locp->file);
+    COUNT   size = leng & ~REC_BLOB;
+
+    assert(recdata < bufp->data || recdata >= recp + sizeof(HXREC) + size);
+    _respace(locp, bufp, bufp->used, 0, sizeof(HXREC) + size + tail, hash);
+    STLG(hash, recp);
+    STSH(leng + tail, recp + sizeof(PAGENO));
+    memcpy(recp + sizeof(HXREC), recdata, size);
+    if (tail)
+        STLG(hash >> 32, recp + sizeof(HXREC) + size);
+}
+
 // _hxalloc: mark an overflow page in the bitmap as used/free.
 void
 _hxalloc(HXLOCAL * locp, PAGENO pgno, int bitval)
@@ -41,7 +77,7 @@ _hxalloc(HXLOCAL * locp, PAGENO pgno, int bitval)
 
     //_hxgrow uses _hxalloc to alloc new map pages.
     assert(bitval || !IS_MAP(hp, pgno));
-    assert(!IS_HEAD(pgno));
+    assert(!IS_HEAD(hp, pgno));
     _hxlock(locp, pos, 1);
 
     pos = pos * hp->pgsize + sizeof(HXPAGE) + (bitpos >> 3);
@@ -66,6 +102,9 @@ _hxalloc(HXLOCAL * locp, PAGENO pgno, int bitval)
     } else {
         _write(locp, pos, &bits, 1);
     }
+
+    if (!bitval && pgno < hp->freehint)
+        hp->freehint = pgno;
 }
 
 // _hxappend: append byte block to buffer.
@@ -79,6 +118,14 @@ _hxappend(HXBUF * bufp, char const *rp, COUNT leng)
     STAIN(bufp);
 }
 
+// _hxdelrec: delete the record at data[pos], keeping hind[] current.
+void
+_hxdelrec(HXLOCAL const *locp, HXBUF * bufp, COUNT pos)
+{
+    assert(pos < bufp->used);
+    _respace(locp, bufp, pos, RECSIZE(bufp->data + pos), 0, 0);
+}
+
 int
 _hxgetfreed(HXLOCAL * locp, HXBUF * bufp)
 {
@@ -103,11 +150,15 @@ _hxputfreed(HXLOCAL * locp, HXBUF * bufp)
 
     DEBUG3("putfreed pgno=%u", pg);
 
-    assert(!bufp->used && !IS_HEAD(bufp->pgno));
+    assert(!bufp->used && !IS_HEAD(locp->file, bufp->pgno));
     assert(pg && pg != locp->freed);
     if (locp->freed)
         _hxflushfreed(locp, bufp);
 
+    // An empty page is no tail to share: _hxshare would try to
+    //  allocate it, while it is still marked 'used'.
+    if (locp->file->tail.pgno == pg)
+        locp->file->tail.used = DATASIZE(locp->file);
     locp->freed = pg;
     SCRUB(bufp);
 }
@@ -125,29 +176,52 @@ _hxflushfreed(HXLOCAL * locp, HXBUF * bufp)
     locp->freed = 0;
 }
 
-// _hxfindfree: search bitmap pages for an empty overflow page.
+// _hxfindfree: allocate the first free overflow page at or after
+//  hp->freehint. Pages this process frees lower the hint, so a
+//  search rarely reads more than one map page. Pages freed by
+//  other processes are found when the hint is rewound to 0, at
+//  most once per 1/8 growth of the file.
 int
 _hxfindfree(HXLOCAL * locp, HXBUF * bufp)
 {
     HXFILE *hp = locp->file;
-    PAGENO  pgno = 0;
-    int     dsize = DATASIZE(hp), ix = dsize;
+    PAGENO  pgno;
 
     assert(!DIRTY(bufp));
-    for (pgno = 0; pgno < locp->npages; pgno = NEXT_MAP(hp, pgno)) {
-        _hxload(locp, bufp, 0);
-        for (ix = bufp->used; ix < dsize && !(0xFF & ~bufp->data[ix]); ++ix);
+    if (hp->freehint >= locp->npages
+        && locp->npages - hp->freescan > locp->npages / 8)
+        hp->freehint = 0;
+    if (!hp->freehint)
+        hp->freescan = locp->npages;
+
+    pgno = _scanfree(locp, bufp, hp->freehint, locp->npages);
+    if (pgno >= locp->npages) {
+        hp->freehint = locp->npages;
+        return 0;
     }
 
-    if (pgno < locp->npages)
-        DEBUG3("npages=%d map: pgno=%d used=%d data[%d]=%02X",
-               locp->npages, pgno, bufp->used, ix,
-               ix < dsize ? bufp->data[ix] : 0x666);
-    if (ix < dsize)
-        pgno +=
-            (((ix - bufp->used) << 3) + ffs(~bufp->data[ix]) - 1) * HXPGRATE;
-    if (pgno >= locp->npages)
+    hp->freehint = pgno + hp->pgrate;
+    _hxalloc(locp, pgno, 1);
+    _hxfresh(locp, bufp, pgno);
+    return 1;
+}
+
+// _hxfindnear: allocate the first free overflow page in
+//  [from,below), without moving hp->freehint. hxdefrag uses
+//  this to place a chain's pages just after each other.
+int
+_hxfindnear(HXLOCAL * locp, HXBUF * bufp, PAGENO from, PAGENO below)
+{
+    PAGENO  pgno;
+
+    assert(!DIRTY(bufp));
+    if (below > locp->npages)
+        below = locp->npages;
+
+    pgno = _scanfree(locp, bufp, from, below);
+    if (pgno >= below)
         return 0;
+
     _hxalloc(locp, pgno, 1);
     _hxfresh(locp, bufp, pgno);
     return 1;
@@ -178,14 +252,16 @@ _hxfresh(HXLOCAL const *locp, HXBUF * bufp, PAGENO pgno)
 
     bufp->next = bufp->used = bufp->recs = bufp->orig = bufp->flag = 0;
     bufp->pgno = pgno;
-    bufp->hsize = bufp->hmask = 1;  //??? Is this right ??
+    bufp->hsize = HIND_SIZE(hp, bufp);
+    bufp->hmask = MASK(bufp->hsize);
     bufp->hind = (COUNT *) (bufp->data + DATASIZE(hp)) + 1;
 
     if (hp->mmap)
         MAP_BUF(hp, bufp);
 
+    // An all-zero hind[] is correct for an empty page.
     memset(bufp->page, 0, hp->pgsize);
-    STAIN(bufp);                // TODO: why is this needed?
+    SPOT(bufp);                 // TODO: why is this needed?
 }
 
 // _hxgrow: extend the file. Each "_hxgrow" creates one or more
@@ -197,13 +273,10 @@ void
 _hxgrow(HXLOCAL * locp, HXBUF * retp, COUNT need, PAGENO * head)
 {
     HXFILE *hp = locp->file;
-    HXBUF  *newp = &locp->buf[0];
-    HXBUF  *oldp = &locp->buf[1];
-    HXBUF  *bufp = &locp->buf[2];
 
-    _hxsave(locp, oldp);
-    _hxsave(locp, newp);
-    _hxsave(locp, bufp);
+    _hxsave(locp, &locp->buf[1]);
+    _hxsave(locp, &locp->buf[0]);
+    _hxsave(locp, &locp->buf[2]);
 
     while (1) {
         PAGENO  newpg = locp->npages++;
@@ -216,7 +289,7 @@ _hxgrow(HXLOCAL * locp, HXBUF * retp, COUNT need, PAGENO * head)
             _hxalloc(locp, newpg - 1, 1);
         } else {
             _hxresize(locp, locp->npages);
-            if (!IS_HEAD(newpg)) {
+            if (!IS_HEAD(hp, newpg)) {
                 DEBUG3("grow ovfl pgno=%d", newpg);
                 _hxalloc(locp, newpg, 1);
                 _hxfresh(locp, retp, newpg);
@@ -225,141 +298,203 @@ _hxgrow(HXLOCAL * locp, HXBUF * retp, COUNT need, PAGENO * head)
         }
 
         _hxpoint(locp);         // because npages has changed
-        PAGENO oldpg = SPLIT_LO(newpg);
-        if (*head == oldpg) {
-            DEBUG3("head=%u", *head);
-            *head = need = 0;   // "need=0" blocks _hxshare
-        }
+        if (_splithead(locp, newpg, head, 0))
+            need = 0;           // "need=0" blocks _hxshare
 
-        _hxlock(locp, oldpg, 1);
-        _hxload(locp, oldp, oldpg);
-        _hxfresh(locp, newp, newpg);
-        // The split target WAS in BEYOND but the file is about
-        // to grow. Need to explicitly bookkeep the target as
-        // still properly locked, else _hxislocked will fail.
-        if (hp->locked & LOCKED_BEYOND && !(hp->locked & LOCKED_BODY))
-            _hxaddlock(hp, newpg);
-
-        LINK(newp, oldp->next);
-        _hxshift(locp, newpg, 0, oldp, newp, NULL);
-
-        int     loops = HX_MAX_CHAIN;
-
-        while (oldp->next) {
-            if (!--loops)
-                LEAVE(locp, HXERR_BAD_FILE);
-            if (bufp->used) {
-                _hxsave(locp, bufp);
-            } else {
-                SCRUB(bufp);
-            }
+        if (_hxshare(locp, retp, need)
+            || _hxgetfreed(locp, retp))
+            return;
+    }
+    //NOTREACHED
+}
 
-            assert(oldp->next == newp->next || !newp->next);
-
-            _hxload(locp, bufp, oldp->next);
-            // _hxshift moves records from bufp to (oldp,newp).
-            // Its return value indicates whether there are still
-            // records in bufp for (both/either/neither)
-            // of oldp and newp.
-            switch (_hxshift(locp, oldpg, newpg, bufp, oldp, newp)) {
-            case 0:
-                LINK(oldp, bufp->next);
-                LINK(newp, bufp->next);
-                if (!bufp->used)
-                    _hxputfreed(locp, bufp);
-                break;
+// _hxsplitall: split each head page from (from) to the end of a
+//  file already resized to hold them, in _hxgrow order. Each split
+//  sees the (dpages,mask) that _hxgrow would have set for it.
+void
+_hxsplitall(HXLOCAL * locp, PAGENO from)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  pg, head = 0;
 
-            case 1:
-                LINK(newp, bufp->next);
-                SWAP(oldp, bufp);
-                break;
+    for (pg = from; pg < locp->npages; ++pg) {
+        if (!IS_HEAD(hp, pg))
+            continue;
 
-            case 2:
-                LINK(oldp, bufp->next);
-                SWAP(newp, bufp);
-                break;
+        locp->dpages = _hxf2d(hp, pg + 1);
+        locp->mask = MASK(locp->dpages);
+        _splithead(locp, pg, &head, 1);
+    }
 
-            case 3:
-                SWAP(oldp, bufp);
-                if (!oldp->next)
-                    break;
+    locp->dpages = _hxf2d(hp, locp->npages);
+    locp->mask = MASK(locp->dpages);
+}
 
-                if (!_hxgetfreed(locp, bufp)) {
-                    PAGENO  pgs[] = { oldp->pgno, newp->pgno };
+//--------------|---------------------------------------------
+// _splithead: move the records of SPLIT_LO(newpg)'s chain that
+//  now hash to (newpg) into it. (sized) is set by _hxsplitall,
+//  whose file cannot grow a page at a time. Returns 1 if the
+//  chain split was (*head), which is then set to 0.
+static int
+_splithead(HXLOCAL * locp, PAGENO newpg, PAGENO * head, int sized)
+{
+    HXFILE *hp = locp->file;
+    HXBUF  *newp = &locp->buf[0];
+    HXBUF  *oldp = &locp->buf[1];
+    HXBUF  *bufp = &locp->buf[2];
+    PAGENO  oldpg = SPLIT_LO(hp, newpg);
+    int     ret = *head == oldpg;
 
-                    // Worst case: _hxgrow needs a new
-                    // ovfl page to complete this chain split.
-                    _hxgrow(locp, bufp, 0, head);
-                    _hxload(locp, oldp, pgs[0]);
-                    _hxload(locp, newp, pgs[1]);
-                }
-
-                LINK(newp, bufp->pgno);
-                SWAP(newp, bufp);
-                LINK(newp, oldp->next);
-                _hxshift(locp, newpg, 0, oldp, newp, NULL);
+    if (ret) {
+        DEBUG3("head=%u", *head);
+        *head = 0;
+    }
+
+    _hxlock(locp, oldpg, 1);
+    _hxload(locp, oldp, oldpg);
+    _hxfresh(locp, newp, newpg);
+    // The split target WAS in BEYOND but the file is about
+    // to grow. Need to explicitly bookkeep the target as
+    // still properly locked, else _hxislocked will fail.
+    if (hp->locked & LOCKED_BEYOND && !(hp->locked & LOCKED_BODY))
+        _hxaddlock(hp, newpg);
+
+    LINK(newp, oldp->next);
+    _hxshift(locp, newpg, 0, oldp, newp, NULL);
+
+    int     loops = HX_MAX_CHAIN;
+
+    while (oldp->next) {
+        if (!--loops)
+            LEAVE(locp, HXERR_BAD_FILE);
+        if (bufp->used) {
+            _hxsave(locp, bufp);
+        } else {
+            SCRUB(bufp);
+        }
+
+        assert(oldp->next == newp->next || !newp->next);
+
+        _hxload(locp, bufp, oldp->next);
+        // _hxshift moves records from bufp to (oldp,newp).
+        // Its return value indicates whether there are still
+        // records in bufp for (both/either/neither)
+        // of oldp and newp.
+        switch (_hxshift(locp, oldpg, newpg, bufp, oldp, newp)) {
+        case 0:
+            LINK(oldp, bufp->next);
+            LINK(newp, bufp->next);
+            if (!bufp->used)
+                _hxputfreed(locp, bufp);
+            break;
+
+        case 1:
+            LINK(newp, bufp->next);
+            SWAP(oldp, bufp);
+            break;
+
+        case 2:
+            LINK(oldp, bufp->next);
+            SWAP(newp, bufp);
+            break;
+
+        case 3:
+            SWAP(oldp, bufp);
+            if (!oldp->next)
                 break;
+
+            if (!_hxgetfreed(locp, bufp)) {
+                PAGENO  pgs[] = { oldp->pgno, newp->pgno };
+
+                // Worst case: _hxgrow needs a new
+                // ovfl page to complete this chain split.
+                if (sized)
+                    _spare(locp, bufp);
+                else
+                    _hxgrow(locp, bufp, 0, head);
+                _hxload(locp, oldp, pgs[0]);
+                _hxload(locp, newp, pgs[1]);
             }
+
+            LINK(newp, bufp->pgno);
+            SWAP(newp, bufp);
+            LINK(newp, oldp->next);
+            _hxshift(locp, newpg, 0, oldp, newp, NULL);
+            break;
         }
+    }
 
-        // Necessary even if tail is not shared
-        if (oldp->next && !FILE_HELD(hp)
-            && !IS_HEAD(oldp->next))
-            _hxunlock(locp, oldp->next, 1);
+    // Necessary even if tail is not shared
+    if (oldp->next && !FILE_HELD(hp)
+        && !IS_HEAD(hp, oldp->next))
+        _hxunlock(locp, oldp->next, 1);
 
-        _hxsave(locp, oldp);
-        _hxsave(locp, newp);
-        _hxsave(locp, bufp);
+    _hxsave(locp, oldp);
+    _hxsave(locp, newp);
+    _hxsave(locp, bufp);
+    return ret;
+}
 
-        if (_hxshare(locp, retp, need)
-            || _hxgetfreed(locp, retp))
-            return;
-    }
-    //NOTREACHED
+// _spare: an overflow page for _hxsplitall: the first free one,
+//  else one added past the end of the file. Heads added with it
+//  are split in their turn; (dpages,mask) stay as they were.
+static void
+_spare(HXLOCAL * locp, HXBUF * retp)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  pg, dpages = locp->dpages, mask = locp->mask;
+    PAGENO  end = locp->npages;
+
+    _hxsave(locp, &locp->buf[1]);
+    _hxsave(locp, &locp->buf[0]);
+    _hxsave(locp, &locp->buf[2]);
+    if (_hxfindnear(locp, retp, 0, end))
+        return;
+
+    for (pg = end; IS_HEAD(hp, pg) || IS_MAP(hp, pg); ++pg) {}
+    _hxresize(locp, pg + 1);
+    locp->dpages = dpages, locp->mask = mask;
+
+    for (; end < pg; ++end)
+        if (IS_MAP(hp, end))
+            _hxalloc(locp, end, 1);
+    DEBUG3("spare pgno=%u", pg);
+    _hxalloc(locp, pg, 1);
+    _hxfresh(locp, retp, pg);
 }
 
 // _hxindexify: construct in-page hash index.
 //  hind points at the LAST of [hsize] COUNT fields.
 //  If not supplied, hind inside bufp is used.
+//  Fingerprints (if any) go in the [hsize] BYTEs below hind[].
+//  Entries are in Robin Hood order; see RH_HIND.
 void
 _hxindexify(HXLOCAL const *locp, HXBUF * bufp, COUNT * hind)
 {
-    int     hsize = HIND_SIZE(locp->file, bufp);
+    HXFILE const *hp = locp->file;
+    int     hsize = HIND_SIZE(hp, bufp);
+    int     inpage = !hind;
 
     if (!hind)
-        hind = HIND_BASE(locp->file, bufp);
-    memset(hind - hsize + 1, 0, hsize * sizeof(COUNT));
+        hind = HIND_BASE(hp, bufp);
 
-    // Pass #1: insert hashes with no collisions:
+    BYTE   *fing = HIND_FING_W(hp, bufp, hind, hsize);
+    char   *bottom = (char *)(fing ? fing - hsize + 1
+                              : (BYTE *) (hind - hsize + 1));
 
-    int     nsaved = 0;
-    struct hr { int     hpos, rpos; } save[bufp->recs];
-    char const *recp, *endp;
-    int     hmask = MASK(hsize);
-
-    FOR_EACH_REC(recp, bufp, endp) {
-        //int i = HIND_POS(bufp, RECHASH(recp));
-        int     pos = recp - bufp->data + 1;
-        int     i = RECHASH(recp) & hmask;
+    // In a version 2 page, bytes between data[used] and hind[]
+    //  may be left from bulk changes; clear them too.
+    if (inpage)
+        memset(bufp->data + bufp->used, 0,
+               bottom - (bufp->data + bufp->used));
+    memset(bottom, 0, hsize * HIND_SLOT(hp, bufp));
 
-        if (i >= hsize)
-            i &= hmask >> 1;
-        if (hind[-i]) {
-            save[nsaved++] = (struct hr) { i, pos};
-        } else {
-            hind[-i] = pos;
-        }
-    }
-
-    // Pass #2: insert collisions:
-    while (nsaved--) {
-        int     i = save[nsaved].hpos;
+    char const *recp, *endp;
+    unsigned mask = MASK(hsize);
 
-        do
-            i = (i ? i : hsize) - 1;
-        while (hind[-i]);
-        hind[-i] = save[nsaved].rpos;
-    }
+    FOR_EACH_REC(recp, bufp, endp)
+        _rhslot(hind, fing, hsize, mask, bufp->data, RECHASH(recp),
+                recp - bufp->data + 1);
 }
 
 // _hxlink: update a "next" link without loading a HXBUF.
@@ -375,7 +510,7 @@ _hxlink(HXLOCAL * locp, PAGENO pg, PAGENO nextpg)
 
     assert(!IS_MAP(hp, pg));
     assert(!nextpg || !IS_MAP(hp, nextpg));
-    assert(!IS_HEAD(nextpg));
+    assert(!IS_HEAD(hp, nextpg));
     assert(nextpg != pg);
 
     locp->changed = 1;
@@ -384,38 +519,37 @@ _hxlink(HXLOCAL * locp, PAGENO pg, PAGENO nextpg)
     _write(locp, pos, &next, sizeof next);
 }
 
-// _hxmove: change a buffer's pgno. For MMAP, this requires
-//  copying BYTEs; for non-MMAP, this just changes .pgno.
+// _hxsetflags: rewrite the root's flags, without loading it.
 void
-_hxmove(HXLOCAL const *locp, HXBUF * bufp, PAGENO pgno)
+_hxsetflags(HXLOCAL * locp, COUNT flags)
 {
-    (void)locp;
-    //HXFILE    *hp = locp->file;
+    HXFILE *hp = locp->file;
+    COUNT   word;
 
-    assert(!DIRTY(bufp));
-    //Currently, only hxshape calls _hxmove,
-    // and hxshape does not allow an mmap'ed file.
-    assert(!locp->file->mmap);
-#   if 0
-    if (hp->mmap)
-        memcpy(&hp->mmap[(off_t) pgno * hp->pgsize], bufp->page, hp->pgsize);
-#   endif
-    STAIN(bufp);
-    bufp->pgno = pgno;
+    DEBUG2("flags=%#x", flags);
+    assert(_hxislocked(locp, 0));
+
+    locp->changed = 1;
+    hp->flags = flags;
+
+    STSH(flags, &word);
+    _write(locp, offsetof(HXROOT, flags), &word, sizeof word);
 }
 
-// _hxremove: Delete byte-block (record) from buffer.
+// _hxmove: change a buffer's pgno. For MMAP, this requires
+//  copying BYTEs; for non-MMAP, this just changes .pgno.
 void
-_hxremove(HXBUF * bufp, COUNT pos, COUNT leng)
+_hxmove(HXLOCAL const *locp, HXBUF * bufp, PAGENO pgno)
 {
-    char   *delp = bufp->data + pos;
-
-    assert(leng > 0 && leng <= bufp->used);
-    assert(pos <= bufp->used);
+    HXFILE *hp = locp->file;
 
-    bufp->used -= leng;
-    memmove(delp, delp + leng, bufp->used - pos);
+    assert(!DIRTY(bufp));
     STAIN(bufp);
+    bufp->pgno = pgno;
+    if (hp->mmap) {
+        memcpy(&hp->mmap[(off_t) pgno * hp->pgsize], bufp->page, hp->pgsize);
+        MAP_BUF(hp, bufp);
+    }
 }
 
 // _hxresize: set file size (shrink or extend).
@@ -428,7 +562,7 @@ _hxresize(HXLOCAL * locp, PAGENO npgs)
         LEAVE(locp, HXERR_FTRUNCATE);
 
     locp->npages = npgs;
-    locp->dpages = _hxf2d(locp->npages);
+    locp->dpages = _hxf2d(hp, locp->npages);
     locp->mask = MASK(locp->dpages);
     _hxpoint(locp);
 
@@ -445,7 +579,7 @@ _hxsave(HXLOCAL * locp, HXBUF * bufp)
         return;
 
     HXFILE *hp = locp->file;
-    COUNT   pgsize = hp->pgsize;
+    unsigned pgsize = hp->pgsize;
 
     bufp->hsize = HIND_SIZE(hp, bufp);
     bufp->hmask = MASK(bufp->hsize);
@@ -457,9 +591,11 @@ _hxsave(HXLOCAL * locp, HXBUF * bufp)
              bufp->pgno, bufp->next, bufp->used, bufp->recs, bufp->hsize,
              bufp->orig, hp->tail.pgno, _hxheads(locp, bufp, headstr));
     }
-    assert(!bufp->pgno || !bufp->next || bufp->used || IS_HEAD(bufp->pgno));
+    assert(!bufp->pgno || !bufp->next || bufp->used || IS_HEAD(hp, bufp->pgno));
     assert(!bufp->pgno || bufp->next != bufp->pgno);
-    assert(FITS(hp, bufp, 0, 0));   // Check that (used,recs) are not out of bounds.
+    // Check that (used,recs) are not out of bounds. The root's
+    //  (recs) is HXROOT.flags.
+    assert(!bufp->pgno || FITS(hp, bufp, 0, 0));
     assert(!IS_MAP(hp, bufp->pgno) || bufp->data[bufp->used] & 1);
     // Ensure that the same page is modified, in two buffers!
     assert(!
@@ -478,7 +614,7 @@ _hxsave(HXLOCAL * locp, HXBUF * bufp)
     STSH(bufp->used, &bufp->page->used);
     STSH(bufp->recs, &bufp->page->recs);
 
-    if (!IS_MAP(hp, bufp->pgno))
+    if (!IS_MAP(hp, bufp->pgno) && UNDEXED(bufp))
         _hxindexify(locp, bufp, NULL);
 
 #if 0
@@ -497,20 +633,41 @@ _hxsave(HXLOCAL * locp, HXBUF * bufp)
 
     SCRUB(bufp);
 
-    if (IS_HEAD(bufp->pgno) || IS_MAP(hp, bufp->pgno))
+    if (IS_HEAD(hp, bufp->pgno) || IS_MAP(hp, bufp->pgno))
         return;
 
+    // A blob page is never a tail to share.
     if (hp->tail.pgno == bufp->pgno) {
-        if (bufp->next)
+        if (bufp->next || IS_BLOBPG(hp, bufp))
             hp->tail.used = DATASIZE(hp);   // mark tail as unsharable.
         else
             hp->tail = *bufp;   // update (used,recs)
-    } else if (!bufp->next && hp->tail.used >= bufp->used)
+    } else if (!bufp->next && hp->tail.used >= bufp->used
+               && !IS_BLOBPG(hp, bufp))
         hp->tail = *bufp;       // update (pgno,used,recs)
 
     assert(hp->tail.next == 0);
 }
 
+// _hxsetrec: replace the record at data[pos] with one having
+//  the same key, keeping hind[] current. Its size may change.
+//  As for _hxaddrec, (leng) may include REC_BLOB.
+void
+_hxsetrec(HXLOCAL const *locp, HXBUF * bufp, COUNT pos,
+          char const *recdata, COUNT leng)
+{
+    char   *recp = bufp->data + pos;
+    int     tail = HASH_TAIL(locp->file);
+    HXHASH  hi = RECHASH64(locp->file, recp) >> 32;
+    COUNT   size = leng & ~REC_BLOB;
+
+    _respace(locp, bufp, pos, RECSIZE(recp), sizeof(HXREC) + size + tail, 0);
+    STSH(leng + tail, recp + sizeof(PAGENO));
+    memcpy(recp + sizeof(HXREC), recdata, size);
+    if (tail)
+        STLG(hi, recp + sizeof(HXREC) + size);
+}
+
 // _hxshare: return 1, and set up buffer, if the last tail
 // page SAVE'd has (need) bytes free. "tail.pgno" is a HINT:
 // the page may have changed since this process last touched it.
@@ -520,13 +677,15 @@ _hxshare(HXLOCAL * locp, HXBUF * bufp, COUNT need)
 {
     HXFILE *hp = locp->file;
 
-    if (!need || !FITS(hp, &hp->tail, need, 1))
+    // The hint may be beyond EOF, if hxshape truncated the file.
+    if (!need || hp->tail.pgno >= locp->npages
+        || !FITS(hp, &hp->tail, need, 1))
         return 0;
 
     _hxload(locp, bufp, hp->tail.pgno);
     DEBUG3("pgno=%d used=%u next=%d need=%u", bufp->pgno, bufp->used,
            bufp->next, need);
-    if (bufp->next || !FITS(hp, bufp, need, 1))
+    if (bufp->next || !FITS(hp, bufp, need, 1) || IS_BLOBPG(hp, bufp))
         return 0;
     if (!bufp->used)
         _hxalloc(locp, bufp->pgno, 1);
@@ -538,50 +697,50 @@ _hxshare(HXLOCAL * locp, HXBUF * bufp, COUNT need)
 //  depending on where each record's hash maps it, until the
 //  target(s) are full. Records that do not belong in either,
 //  or do not fit in either, are left in (srcp).
+// Each record moved is deleted with _hxdelrec, which keeps
+//  hind[] current; past SHIFT_TRACK records, it is cheaper
+//  to let _hxsave reindex (srcp).
 // RETURNS bitmask where bits [0,1] mean records left
 // not moved from srcp to [lowerp,upperp].
 // If called with lowerp == upperp, return 3 rather than 1.
+enum { SHIFT_TRACK = 16 };
+
 int
 _hxshift(HXLOCAL const *locp, PAGENO lo, PAGENO hi,
          HXBUF * srcp, HXBUF * lowerp, HXBUF * upperp)
 {
-    COUNT   size;
     HXFILE *hp = locp->file;
     HXBUF  *dstv[] = { srcp, lowerp, upperp };
-    char   *recp = srcp->data;
-    char   *endp = recp + srcp->used;
-    int     filled = 0;
+    int     pos = 0, filled = 0, moved = 0;
 
     assert((lo != hi) || (lowerp == upperp));
-    srcp->used = srcp->recs = 0;    // prep for _hxappend(srcp,...)
 
-    // NOT a FOR_EACH_REC loop here, since srcp->used
-    //  has been zapped (to be both an input and an output).
-    for (; recp < endp; recp += size) {
-        PAGENO  test = _hxhead(locp, RECHASH(recp));
+    while (pos < srcp->used) {
+        char   *recp = srcp->data + pos;
+        PAGENO  test = _hxhead(locp, RECHASH64(hp, recp));
         int     whither = test == hi ? 2 : test == lo ? 1 : 0;
         HXBUF  *dstp = dstv[whither];
+        COUNT   size = RECSIZE(recp);
 
-        size = RECSIZE(recp);
-        if (!FITS(hp, dstp, size, 1)) {
+        if (whither && !FITS(hp, dstp, size, 1)) {
             dstp = srcp;
             filled |= lowerp == upperp ? 3 : whither;
-            if (filled == 3 && (unsigned)size * HXPGRATE
-                < (unsigned)DATASIZE(hp)) {
-                size = endp - recp;
-            }
+            if (filled == 3 && (unsigned)size * hp->pgrate
+                < (unsigned)DATASIZE(hp))
+                break;
         }
 
-        if (recp != dstp->data + dstp->used) {
-            memmove(&dstp->data[dstp->used], recp, size);
-            STAIN(dstp);
+        if (dstp == srcp) {
+            pos += size;
+            continue;
         }
-        dstp->used += size;
-        dstp->recs++;
-    }
 
-    if (SHRUNK(srcp))
-        STAIN(srcp);
+        _hxaddrec(locp, dstp, RECHASH64(hp, recp), RECDATA(recp),
+                  USERLENG(hp, recp) | IS_BLOB(recp));
+        if (++moved == SHIFT_TRACK)
+            STAIN(srcp);
+        _hxdelrec(locp, srcp, pos);
+    }
 
     return filled;
 }
@@ -599,6 +758,251 @@ _hxtemp(HXLOCAL * locp, char *vbuf, int vbufsize)
 }
 
 //--------------|---------------------------------------------
+// _scanfree: the first free overflow page at or after (from),
+//  searching the bitmaps; a pgno >= (below) if none is before it.
+static PAGENO
+_scanfree(HXLOCAL * locp, HXBUF * bufp, PAGENO from, PAGENO below)
+{
+    HXFILE *hp = locp->file;
+    PAGENO  pgno, mpg = 0;
+    int     bit = -1;
+
+    pgno = (from + hp->pgrate - 1) / hp->pgrate * hp->pgrate;
+    while (pgno < below) {
+        int     waslocked = _hxislocked(locp, mpg = _hxmap(hp, pgno, &bit));
+
+        _hxload(locp, bufp, mpg);
+        bit = _freebit((BYTE const *)bufp->data, DATASIZE(hp), bit);
+        DEBUG3("npages=%d map: pgno=%d bit=%d", locp->npages, mpg, bit);
+        if (bit >= 0)
+            break;
+        if (mpg && !waslocked && !FILE_HELD(hp))
+            _hxunlock(locp, mpg, 1);
+        pgno = NEXT_MAP(hp, mpg);
+    }
+
+    if (bit >= 0)
+        pgno = mpg + (bit - (mpg ? 0 : 8 * hp->uleng)) * hp->pgrate;
+    return pgno;
+}
+
+// _freebit: first zero bit at or after (bit) in map[nbytes],
+//  or -1. Full stretches are skipped a 64-bit word at a time.
+static int
+_freebit(BYTE const *map, int nbytes, int bit)
+{
+    int     i = bit >> 3;
+    BYTE    b = ~map[i] & (0xFF << (bit & 7));
+
+    while (!b && ++i < nbytes) {
+        uint64_t w;
+
+        if (!(i & 7))
+            for (; i + 8 <= nbytes; i += 8)
+                if (memcpy(&w, map + i, sizeof w), ~w)
+                    break;
+        if (i < nbytes)
+            b = ~map[i];
+    }
+
+    return b ? i * 8 + ffs(b) - 1 : -1;
+}
+
+// _putslot: insert (pos) into hind[] for a record with (hash).
+static void
+_putslot(HXLOCAL const *locp, HXBUF * bufp, HXHASH hash, COUNT pos)
+{
+    COUNT  *hind = HIND_BASE(locp->file, bufp);
+
+    _rhslot(hind, HIND_FING_W(locp->file, bufp, hind, bufp->hsize),
+            bufp->hsize, bufp->hmask, bufp->data, hash, pos);
+}
+
+// _respace: resize the byte block at data[pos] from (oldsize)
+//  to (newsize), moving the bytes after it, and update hind[]:
+//  oldsize == 0 adds a record with (hash) at pos;
+//  newsize == 0 deletes the record at pos.
+// hind[] shrinks or grows with (used). Entries whose slot is lost,
+//  or whose home slot moves, are taken (with their probe runs) into
+//  behind[], offsets are shifted past pos, and behind[] reinserted.
+// If hind[]'s mask or slot size changes, or behind[] overflows,
+//  the page is marked for a full _hxindexify instead.
+static void
+_respace(HXLOCAL const *locp, HXBUF * bufp, int pos, int oldsize,
+         int newsize, HXHASH hash)
+{
+    HXFILE const *hp = locp->file;
+    char   *cp = bufp->data + pos;
+    int     tail = bufp->used - pos - oldsize;
+    int     delta = newsize - oldsize;
+    int     hsize = bufp->hsize, hmask = bufp->hmask;
+    int     undexed = UNDEXED(bufp);
+    COUNT  *hind = HIND_BASE(hp, bufp);
+    BYTE   *fing = HIND_FING_W(hp, bufp, hind, hsize);
+    int     i, half = (hmask + 1) / 2;
+
+    assert(undexed || hsize == HIND_SIZE(hp, bufp));
+    assert(oldsize || !tail);   // records are only added at the end
+    bufp->used += delta;
+    bufp->recs += !oldsize - !newsize;
+
+    int     nsize = HIND_SIZE(hp, bufp);
+    BYTE   *nfing = HIND_FING_W(hp, bufp, hind, nsize);
+
+    bufp->nbehind = 0;
+    undexed = undexed || (int)MASK(nsize) != hmask || !fing != !nfing;
+
+    if (!undexed && !newsize) {     // unindex the deleted record
+        for (i = RECHASH(cp) & hmask, i = i < hsize ? i : i & (half - 1);
+             hind[-i] != pos + 1; i = (i ? i : hsize) - 1)
+            assert(hind[-i]);
+        hind[-i] = 0;
+        if (fing)
+            fing[-i] = 0;
+        undexed = !_takerun(locp, bufp, (i ? i : hsize) - 1);
+    }
+
+    if (undexed) {
+    } else if (nsize < hsize) {
+        // Slots [nsize,hsize) are lost; homes in that range fold
+        //  into the run below nsize. Fingerprints move up.
+        for (i = nsize; i < hsize && !undexed; ++i)
+            undexed = !_takeslot(locp, bufp, i);
+        undexed = undexed || !_takerun(locp, bufp, nsize - 1);
+        if (!undexed && fing)
+            memmove(nfing - nsize + 1, fing - nsize + 1, nsize);
+    } else if (nsize > hsize) {
+        // Homes in [hsize,nsize) were folded down by (half),
+        //  and runs that wrapped from 0 to hsize-1 must re-wrap.
+        for (i = nsize - half; --i >= hsize - half;)
+            undexed = undexed || !_takeslot(locp, bufp, i);
+        undexed = undexed || !_takerun(locp, bufp, hsize - half - 1)
+            || !_takerun(locp, bufp, hsize - 1);
+    }
+
+    memmove(cp + newsize, cp + oldsize, tail);
+    if (delta < 0)
+        memset(bufp->data + bufp->used, 0, -delta);
+
+    if (undexed) {
+        bufp->nbehind = 0;
+        STAIN(bufp);
+        return;
+    }
+
+    if (nsize > hsize) {
+        if (fing) {
+            memmove(nfing - hsize + 1, fing - hsize + 1, hsize);
+            memset(nfing - nsize + 1, 0, nsize - hsize);
+        }
+        memset(hind - nsize + 1, 0, (nsize - hsize) * sizeof(COUNT));
+    }
+
+    bufp->hsize = nsize;
+    if (delta) {
+        _shiftpos(hind - nsize + 1, nsize, pos, delta);
+        _shiftpos(bufp->behind, bufp->nbehind, pos, delta);
+    }
+
+    for (i = 0; i < bufp->nbehind; ++i)
+        _putslot(locp, bufp, RECHASH(bufp->data + bufp->behind[i] - 1),
+                 bufp->behind[i]);
+    bufp->nbehind = 0;
+
+    if (!oldsize)
+        _putslot(locp, bufp, hash, pos + 1);
+
+    SPOT(bufp);
+}
+
+// _rhslot: Robin Hood insert of (pos) into hind[]. Probing down
+//  from the home slot, (pos) displaces the first entry nearer its
+//  own home, which then carries on down in its place. Resident
+//  homes come from RECHASH in recs[]; the record at (pos) need not
+//  be written yet.
+static void
+_rhslot(COUNT * hind, BYTE * fing, int hsize, unsigned mask,
+        char const *recs, HXHASH hash, COUNT pos)
+{
+    int     i = HIND_HOME(hash, mask, hsize), dist = 0;
+
+    for (; hind[-i]; i = (i ? i : hsize) - 1, ++dist) {
+        HXHASH  rhash = RECHASH(recs + hind[-i] - 1);
+        int     rdist = HIND_DIST(HIND_HOME(rhash, mask, hsize), i, hsize);
+
+        if (rdist < dist) {
+            SWAP(pos, hind[-i]);
+            if (fing)
+                fing[-i] = FINGER(hash);
+            hash = rhash, dist = rdist;
+        }
+    }
+
+    hind[-i] = pos;
+    if (fing)
+        fing[-i] = FINGER(hash);
+}
+
+// _shiftpos: add (delta) to the offsets in vp[n] that are past pos.
+static void
+_shiftpos(COUNT * vp, int n, int pos, int delta)
+{
+    int     i = 0;
+
+#ifdef __SSE2__
+    // Offsets run up to 64K: (x > pos + 1) is an unsigned compare,
+    //  i.e. a nonzero saturated (x - (pos + 1)).
+    __m128i xpos = _mm_set1_epi16(pos + 1), xdelta = _mm_set1_epi16(delta);
+    __m128i v0 = _mm_setzero_si128();
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((__m128i *) (vp + i));
+        __m128i le = _mm_cmpeq_epi16(_mm_subs_epu16(x, xpos), v0);
+
+        x = _mm_add_epi16(x, _mm_andnot_si128(le, xdelta));
+        _mm_storeu_si128((__m128i *) (vp + i), x);
+    }
+#endif
+    for (; i < n; ++i)
+        if (vp[i] > pos + 1)
+            vp[i] += delta;
+}
+
+// _takerun: take entries from slot i downward (wrapping) up to
+//  the next empty slot. Returns 0 if behind[] overflows.
+static int
+_takerun(HXLOCAL const *locp, HXBUF * bufp, int i)
+{
+    COUNT  *hind = HIND_BASE(locp->file, bufp);
+    int     n = bufp->hsize;
+
+    for (; hind[-i] && n--; i = (i ? i : bufp->hsize) - 1)
+        if (!_takeslot(locp, bufp, i))
+            return 0;
+
+    return n >= 0;
+}
+
+// _takeslot: move the entry (if any) in hind[-i] into behind[].
+//  Returns 0 if behind[] overflows.
+static int
+_takeslot(HXLOCAL const *locp, HXBUF * bufp, int i)
+{
+    COUNT  *hind = HIND_BASE(locp->file, bufp);
+    BYTE   *fing = HIND_FING_W(locp->file, bufp, hind, bufp->hsize);
+
+    if (!hind[-i])
+        return 1;
+    if (bufp->nbehind == sizeof bufp->behind / sizeof *bufp->behind)
+        return 0;
+
+    bufp->behind[bufp->nbehind++] = hind[-i];
+    hind[-i] = 0;
+    if (fing)
+        fing[-i] = 0;
+    return 1;
+}
+
 static void
 _write(HXLOCAL * locp, off_t pos, void *buf, int len)
 {
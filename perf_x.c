@@ -24,6 +24,16 @@
 #include "hx_.h"
 #include "util.h"
 
+// count: hxscan callback; sums record lengths, so the scan
+//  touches every record.
+static int
+count(char const *rec, int leng, void *ctx)
+{
+    (void)rec;
+    *(long *)ctx += leng;
+    return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -77,11 +87,17 @@ main(int argc, char **argv)
         die(": cannot read %s:", inpfile);
     setvbuf(fp, NULL, _IOFBF, 65536);
 
+    // tb: hxbuild time, mostly parsing and sorting records by head
+    //  (HXDEBUG=1 shows the sort time of each partition).
+    double  tb = 0;
+
     if (memsize) {
         memsize = 1 << memsize;
         hxcreate("perf_x.hx", 0644, 4096, 0, 0);
         hp = hxopen("perf_x.hx", HX_UPDATE);
+        tb = tick();
         rc = hxbuild(hp, fp, memsize, 0.0);
+        tb = tick() - tb;
         if (rc < 0)
             die("hxbuild(%d): %s", memsize, hxerror(rc));
         hxclose(hp);
@@ -190,16 +206,31 @@ main(int argc, char **argv)
     }
     t7 = tick() - t7;
 
+    double  t8 = tick();
+
+    while (hxnext(hp, rec, sizeof rec) > 0) {
+    }
+    t8 = tick() - t8;
+
+    double  t9 = tick();
+    long    nbytes = 0;
+
+    hxscan(hp, count, &nbytes);
+    t9 = tick() - t9;
+
     hxstat(hp, &info);
     fprintf(stderr, "nrecs: %g build: %.2fM rec/sec\n(usec:)\n"
             "\tget-y\t%.2f\n\tget-n\t%.2f\n"
             "\tput+12\t%.2f\n\tput+0\t%.2f\n\tput+100\t%.2f\n"
-            "\tget-y\t%.2f\n\tget-n\t%.2f\n\tput-xx\t%.2f\n",
-            info.nrecs, info.nrecs / 1E6 / t0, t0 * 1E6 / info.nrecs,
+            "\tget-y\t%.2f\n\tget-n\t%.2f\n\tput-xx\t%.2f\n"
+            "\tnext\t%.3f\n\tscan\t%.3f\n",
+            info.nrecs, tb ? info.nrecs / 1E6 / tb : 0.0,
+            t0 * 1E6 / info.nrecs,
             t1 * 1E6 / info.nrecs, t2 * 1E6 / info.nrecs,
             t3 * 1E6 / info.nrecs, t4 * 1E6 / info.nrecs,
             t5 * 1E6 / info.nrecs, t6 * 1E6 / info.nrecs,
-            t7 * 1E6 / info.nrecs);
+            t7 * 1E6 / info.nrecs, t8 * 1E6 / info.nrecs,
+            t9 * 1E6 / info.nrecs);
 
     return 0;
 }
@@ -0,0 +1,270 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// scan_t: hxscan, hxscan_live, hxscan_from and hxscan_part
+//  return each record once.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "tap.h"
+
+#include "hx.h"
+
+#define NRECS   20000
+#define NPARTS  5
+
+// Each record's index is counted in seen[]; (stop) > 0 stops the scan.
+//  If (go) is set, the first record writes a byte to it; one record
+//  in 32 takes (slow) usec.
+typedef struct {
+    unsigned char *seen;
+    int     stop, go, slow;
+} SCAN;
+
+static int
+mark(char const *rec, int leng, void *ctx)
+{
+    SCAN   *sp = ctx;
+
+    (void)leng;
+    ++sp->seen[atoi(rec + 1)];
+    if (sp->go) {
+        if (write(sp->go, "", 1) != 1)
+            return 1;
+        sp->go = 0;
+    }
+    if (sp->slow && !(atoi(rec + 1) % 32))
+        usleep(sp->slow);
+    return sp->stop && !--sp->stop;
+}
+
+static char *
+mkrec(char *buf, int i)
+{
+    sprintf(buf, "k%05d", i);
+    sprintf(buf + 7, "value %d", i * 7919);
+    return buf;
+}
+
+static int
+reclen(char const *rec)
+{
+    return 7 + strlen(rec + 7) + 1;
+}
+
+// once: number of records in [0,nrecs) seen other than once.
+static int
+once(unsigned char const *seen, int nrecs)
+{
+    int     i, bad = 0;
+
+    for (i = 0; i < nrecs; ++i)
+        bad += seen[i] != 1;
+    return bad;
+}
+
+int
+main(void)
+{
+    HXRET   rc;
+    HXFILE *hp;
+    HXMODE  mode;
+    static unsigned char seen[2 * NRECS];
+    SCAN    scan = { seen, 0, 0, 0 };
+    pid_t   child;
+    char    rec[32];
+    int     i, part, total, bad, nrecs, fd[NPARTS][2];
+
+    plan_tests(2 * 14);
+    setvbuf(stdout, 0, _IOLBF, 0);
+
+    for (mode = 0; mode <= HX_MMAP; mode += HX_MMAP) {
+        rc = hxcreate("scan_t.hx", 0644, 1024, NULL, 0);
+        ok(HXOKAY == rc, "created scan_t.hx: %s", hxerror(rc));
+        hp = hxopen("scan_t.hx", HX_UPDATE + mode);
+
+        for (i = 0; i < NRECS / 2; ++i) {
+            mkrec(rec, i);
+            if (0 > (rc = hxput(hp, rec, reclen(rec))))
+                break;
+        }
+        ok(i == NRECS / 2, "inserted %d records: %s", i, hxerror(rc));
+
+        rc = hxscan_part(hp, NPARTS, NPARTS, mark, &scan);
+        ok(rc == HXERR_BAD_REQUEST, "hxscan_part rejects part >= nparts: %s",
+           hxerror(rc));
+
+        memset(seen, 0, sizeof seen);
+        rc = hxscan_part(hp, 0, 1, mark, &scan);
+        ok(rc == NRECS / 2 && !once(seen, NRECS / 2),
+           "one partition returns every record once: %d", rc);
+
+        memset(seen, 0, sizeof seen);
+        rc = hxscan(hp, mark, &scan);
+        ok(rc == NRECS / 2 && !once(seen, NRECS / 2),
+           "hxscan returns every record once: %d", rc);
+
+        // The file grows between partitions: a record's partition
+        //  does not depend on the file size.
+        memset(seen, 0, sizeof seen);
+        for (part = total = 0; part < NPARTS; ++part) {
+            total += rc = hxscan_part(hp, part, NPARTS, mark, &scan);
+            for (i = 0; i < NRECS / 2 / NPARTS; ++i) {
+                int     j = NRECS / 2 + part * NRECS / 2 / NPARTS + i;
+
+                mkrec(rec, j);
+                hxput(hp, rec, reclen(rec));
+            }
+        }
+        for (i = NRECS / 2, bad = 0; i < NRECS; ++i)
+            bad += seen[i] > 1;
+        ok(!bad && !once(seen, NRECS / 2),
+           "%d partitions return each record once as the file grows: %d",
+           NPARTS, total);
+
+        // Partitions in concurrent processes, each with its own pipe.
+        for (part = 0; part < NPARTS; ++part) {
+            if (pipe(fd[part]))
+                return 1;
+            if (fork()) {
+                close(fd[part][1]);
+                continue;
+            }
+            hxclose(hp);
+            hp = hxopen("scan_t.hx", HX_READ + mode);
+            memset(seen, 0, sizeof seen);
+            rc = hxscan_part(hp, part, NPARTS, mark, &scan);
+            if (write(fd[part][1], seen, NRECS) != NRECS)
+                rc = -1;
+            _exit(rc < 0);
+        }
+        memset(seen, 0, sizeof seen);
+        for (part = bad = 0; part < NPARTS; ++part) {
+            unsigned char got[NRECS];
+            int     status, n = 0, k;
+
+            while (n < NRECS && (k = read(fd[part][0], got + n, NRECS - n)) > 0)
+                n += k;
+            for (i = 0; i < n; ++i)
+                seen[i] += got[i];
+            wait(&status);
+            bad += n != NRECS || status;
+            close(fd[part][0]);
+        }
+        ok(!bad && !once(seen, NRECS),
+           "%d concurrent processes return each record once", NPARTS);
+
+        memset(seen, 0, sizeof seen);
+        rc = hxscan_live(hp, mark, &scan);
+        ok(rc == NRECS && !once(seen, NRECS),
+           "hxscan_live returns every record once: %d", rc);
+
+        // A writer process adds records, splitting chains, while a
+        //  slow hxscan_live runs; it finishes before the scan does.
+        if (pipe(fd[0]))
+            return 1;
+        if (!(child = fork())) {
+            close(fd[0][1]);
+            hxclose(hp);
+            hp = hxopen("scan_t.hx", HX_UPDATE + mode);
+            if (read(fd[0][0], rec, 1) != 1)
+                _exit(1);
+            for (i = NRECS; i < NRECS + NRECS / 4; ++i) {
+                mkrec(rec, i);
+                if (0 > hxput(hp, rec, reclen(rec)))
+                    _exit(1);
+            }
+            _exit(0);
+        }
+        close(fd[0][0]);
+        memset(seen, 0, sizeof seen);
+        scan.go = fd[0][1];
+        scan.slow = 1000;
+        rc = hxscan_live(hp, mark, &scan);
+        scan.slow = 0;
+        close(fd[0][1]);
+
+        int     status = -1;
+
+        bad = waitpid(child, &status, WNOHANG) != child || status;
+        if (bad)
+            waitpid(child, &status, 0);
+        for (i = NRECS; i < NRECS + NRECS / 4; ++i)
+            bad += seen[i] > 1;
+        ok(!bad && !once(seen, NRECS),
+           "hxscan_live does not block a writer: %d records", rc);
+
+        // Resumable slices, with the cursor kept as bytes, and
+        //  records added between slices.
+        HXCURSOR cursor = { };
+        unsigned char saved[sizeof cursor];
+        int     slices = 0;
+
+        memset(seen, 0, sizeof seen);
+        memcpy(saved, &cursor, sizeof saved);
+        for (total = 0;; ++slices) {
+            memcpy(&cursor, saved, sizeof cursor);
+            if ((rc = hxscan_from(hp, &cursor, 1000, mark, &scan)) <= 0)
+                break;
+            total += rc;
+            memcpy(saved, &cursor, sizeof saved);
+            mkrec(rec, NRECS + NRECS / 4 + slices);
+            hxput(hp, rec, reclen(rec));
+        }
+        for (i = NRECS, bad = 0; i < 2 * NRECS; ++i)
+            bad += seen[i] > 1;
+        ok(rc == 0 && !bad && !once(seen, NRECS + NRECS / 4),
+           "hxscan_from passed %d records in %d slices", total, slices);
+
+        // A stopped slice is repeated: at least once.
+        memset(&cursor, 0, sizeof cursor);
+        memset(seen, 0, sizeof seen);
+        scan.stop = 10;
+        rc = hxscan_from(hp, &cursor, 1000, mark, &scan);
+        while (hxscan_from(hp, &cursor, 1000, mark, &scan) > 0) {
+        }
+        for (i = bad = 0; i < NRECS + NRECS / 4; ++i)
+            bad += !seen[i];
+        ok(rc == 10 && !bad, "stopped slice resumes: %d missing", bad);
+
+        memset(&cursor, 0xFF, sizeof cursor);
+        rc = hxscan_from(hp, &cursor, 1000, mark, &scan);
+        ok(rc == HXERR_BAD_REQUEST, "hxscan_from rejects a bad cursor: %s",
+           hxerror(rc));
+
+        scan.stop = 10;
+        rc = hxscan_part(hp, 1, 2, mark, &scan);
+        ok(rc == 10 && !scan.stop, "fn stops the scan after %d records", rc);
+
+        hxclose(hp);
+        hp = hxopen("scan_t.hx", HX_READ + mode);
+        memset(seen, 0, sizeof seen);
+        for (part = total = 0; part < 3; ++part)
+            total += hxscan_part(hp, part, 3, mark, &scan);
+        nrecs = NRECS + NRECS / 4 + slices;
+        ok(total == nrecs && !once(seen, nrecs),
+           "READ handle: 3 partitions return %d records", total);
+        hxclose(hp);
+    }
+
+    return exit_status();
+}
@@ -0,0 +1,227 @@
+// Copyright (C) 2001-2013 Mischa Sandberg <mischasan@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License Version 2 as
+// published by the Free Software Foundation.  You may not use, modify or
+// distribute this program under any other version of the GNU General
+// Public License.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+//  IF YOU HAVE NO WAY OF WORKING WITH GPL, CONTACT ME.
+//-------------------------------------------------------------------------------
+// shape_t: hxshape_step grows and shrinks a file incrementally;
+//  hxreserve pre-sizes it for a load; hxshape and hxpack reshape it
+//  in one call; hxdefrag brings chains back together; hxautogrow
+//  makes hxput split the file as it fills, and hxautoshrink makes
+//  hxdel merge it back as it empties.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tap.h"
+
+#include "hx.h"
+
+#define NRECS   5000
+
+static char *
+mkrec(char *buf, int i)
+{
+    sprintf(buf, "k%05d", i);
+    sprintf(buf + 7, "value %d", i * 7919);
+    return buf;
+}
+
+static int
+reclen(char const *rec)
+{
+    return 7 + strlen(rec + 7) + 1;
+}
+
+static off_t
+npages(HXFILE * hp)
+{
+    return lseek(hxfileno(hp), 0, SEEK_END) / 1024;
+}
+
+static int
+missing(HXFILE * hp, char recs[][32], int step)
+{
+    int     i, n = 0;
+
+    for (i = 0; i < NRECS; i += step) {
+        char    buf[32];
+
+        strcpy(buf, recs[i]);
+        n += hxget(hp, buf, sizeof buf) <= 0;
+    }
+    return n;
+}
+
+int
+main(void)
+{
+    HXRET   rc;
+    HXFILE *hp;
+    HXMODE  mode;
+    static char recs[NRECS][32];
+    char const *keyv[NRECS];
+    int     i, nkeys, steps, calls;
+    off_t   size;
+    HXSTAT  before, after;
+
+    plan_tests(2 * 25);
+    setvbuf(stdout, 0, _IOLBF, 0);
+
+    for (mode = 0; mode <= HX_MMAP; mode += HX_MMAP) {
+        rc = hxcreate("shape_t.hx", 0644, 1024, NULL, 0);
+        ok(HXOKAY == rc, "created shape_t.hx: %s", hxerror(rc));
+
+        hp = hxopen("shape_t.hx", HX_UPDATE + mode);
+        ok(hp, "opened shape_t.hx with %s", hxmode(HX_UPDATE + mode));
+
+        for (i = 0; i < NRECS; ++i) {
+            mkrec(recs[i], i);
+            if (0 > (rc = hxput(hp, recs[i], reclen(recs[i]))))
+                break;
+        }
+        ok(i == NRECS, "inserted %d/%d records: %s", i, NRECS, hxerror(rc));
+
+        rc = hxshape_step(hp, -1, 1);
+        ok(rc == HXERR_BAD_REQUEST, "hxshape_step rejects overload < 0: %s",
+           hxerror(rc));
+
+        // Grow until no overflow pages are wanted.
+        size = npages(hp);
+        for (calls = steps = 0; (rc = hxshape_step(hp, 0.0, 7)) > 0; ++calls)
+            steps += rc;
+        ok(rc == 0 && steps > 0 && npages(hp) == size + steps,
+           "grew %lld pages by %d in %d calls: %s",
+           (long long)size, steps, calls, hxerror(rc));
+        ok(!missing(hp, recs, 1), "no records lost by growing");
+
+        rc = hxshape_step(hp, 0.0, 7);
+        ok(rc == 0, "file is already in shape: %d", rc);
+
+        // Delete nine of every ten records, then pack.
+        for (i = nkeys = 0; i < NRECS; ++i)
+            if (i % 10)
+                keyv[nkeys++] = recs[i];
+        rc = hxdelv(hp, keyv, nkeys);
+        ok(rc == nkeys, "deleted %d/%d records", rc, nkeys);
+
+        size = npages(hp);
+        for (steps = 0; (rc = hxshape_step(hp, 9E9, 50)) > 0;)
+            steps += rc;
+        ok(rc == 0 && npages(hp) == size - steps && npages(hp) * 4 < size,
+           "shrank %lld pages to %lld: %s", (long long)size,
+           (long long)npages(hp), hxerror(rc));
+        ok(!missing(hp, recs, 10), "no records lost by shrinking");
+
+        // Reserve room for all the records again, then reload them.
+        rc = hxreserve(hp, NRECS, 0);
+        ok(rc == HXERR_BAD_REQUEST, "hxreserve rejects avg_reclen < 1: %s",
+           hxerror(rc));
+
+        size = npages(hp);
+        rc = hxreserve(hp, NRECS, 24);
+        ok(rc > 0 && npages(hp) == size + rc, "reserved %lld pages by %d",
+           (long long)size, rc);
+        ok(!missing(hp, recs, 10), "no records lost by reserving");
+
+        size = npages(hp);
+        for (i = 0; i < NRECS; ++i)
+            if (0 > (rc = hxput(hp, recs[i], reclen(recs[i]))))
+                break;
+        ok(i == NRECS && npages(hp) == size,
+           "reloaded %d/%d records in %lld pages", i, NRECS,
+           (long long)npages(hp));
+
+        rc = hxreserve(hp, NRECS, 24);
+        ok(rc == 0, "file is already big enough: %d", rc);
+
+        // hxshape and hxpack, in one call each.
+        size = npages(hp);
+        rc = hxshape(hp, 0.0);
+        ok(rc >= 0 && npages(hp) > size && !missing(hp, recs, 1),
+           "hxshape grew %lld pages to %lld: %s", (long long)size,
+           (long long)npages(hp), hxerror(rc));
+
+        size = npages(hp);
+        rc = hxpack(hp);
+        ok(rc == HXOKAY && npages(hp) * 3 < size * 2 && !missing(hp, recs, 1),
+           "hxpack shrank %lld pages to %lld: %s", (long long)size,
+           (long long)npages(hp), hxerror(rc));
+
+        // Deleting leaves chains with free pages between them.
+        for (i = nkeys = 0; i < NRECS; ++i)
+            if (i % 2)
+                keyv[nkeys++] = recs[i];
+        hxdelv(hp, keyv, nkeys);
+        hxstat(hp, &before);
+
+        rc = hxdefrag(hp, 0);
+        ok(rc == HXERR_BAD_REQUEST, "hxdefrag rejects budget < 1: %s",
+           hxerror(rc));
+
+        size = npages(hp);
+        for (calls = steps = 0; (rc = hxdefrag(hp, 1)) > 0; ++calls)
+            steps += rc;
+        hxstat(hp, &after);
+        ok(rc == 0 && steps > 0 && npages(hp) == size,
+           "moved %d pages in %d calls: %s", steps, calls, hxerror(rc));
+        ok(after.back_links < before.back_links
+           && after.avg_link_dist < before.avg_link_dist
+           && after.nrecs == NRECS - nkeys && !missing(hp, recs, 2),
+           "links %.1f apart, %.0f%% back; were %.1f, %.0f%%",
+           after.avg_link_dist, after.back_links * 100,
+           before.avg_link_dist, before.back_links * 100);
+
+        // Reload the deleted records, splitting at 50% full.
+        rc = hxautogrow(hp, 128);
+        ok(rc == HXERR_BAD_REQUEST, "hxautogrow rejects fill > 127: %s",
+           hxerror(rc));
+
+        hxautogrow(hp, 50);
+        for (i = 0; i < NRECS; ++i)
+            if (i % 2 && 0 > (rc = hxput(hp, recs[i], reclen(recs[i]))))
+                break;
+        hxstat(hp, &after);
+        ok(i == NRECS && after.nrecs == NRECS
+           && after.head_bytes > after.ovfl_bytes * 4
+           && !missing(hp, recs, 1),
+           "reloaded %d/%d records; %.0f%% in head pages", i, NRECS,
+           after.head_bytes * 100 / (after.head_bytes + after.ovfl_bytes));
+
+        rc = hxautoshrink(hp, 50);
+        ok(rc == HXERR_BAD_REQUEST, "hxautoshrink rejects low >= fill: %s",
+           hxerror(rc));
+
+        hxautoshrink(hp, 20);
+        for (i = 0; i < NRECS; ++i)
+            if (i % 8 && 0 > (rc = hxdel(hp, recs[i])))
+                break;
+        hxstat(hp, &before);
+        ok(i == NRECS && before.nrecs == (NRECS + 7) / 8
+           && before.npages * 2 < after.npages && !missing(hp, recs, 8),
+           "hxdel shrank the file from %.0f to %.0f pages",
+           after.npages, before.npages);
+        hxclose(hp);
+
+        hp = hxopen("shape_t.hx", HX_READ);
+        rc = hxfix(hp, 0, 0, 0, 0);
+        ok(rc == (HXRET) HX_UPDATE, "file not corrupted: %s", hxmode(rc));
+        hxclose(hp);
+    }
+
+    return exit_status();
+}